@@ -0,0 +1,149 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include "bloom_filter.h"
+
+namespace badgerdb
+{
+
+/*
+ * Tag at the start of a saved filter.
+*/
+static const std::uint32_t BLOOM_FILE_MAGIC = 0x424c4f53;
+
+/*
+ * 64-bit mix of the key (splitmix64 finalizer), so that neighbouring keys
+ * land in unrelated blocks.
+*/
+static std::uint64_t hashKey(int key)
+{
+	std::uint64_t h = (std::uint64_t)(std::uint32_t)key + 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+BloomFilter::BloomFilter(std::uint64_t expectedKeys, double falsePositiveRate)
+{
+	if (expectedKeys == 0)
+		expectedKeys = 1;
+	if (falsePositiveRate <= 0 || falsePositiveRate >= 1)
+		falsePositiveRate = 0.01;
+
+	// m = -n ln(p) / ln(2)^2 bits, k = m/n ln(2) bits per key
+	double ln2 = std::log(2.0);
+	double bits = -(double)expectedKeys * std::log(falsePositiveRate) / (ln2 * ln2);
+	numBlocks = (std::uint32_t)std::ceil(bits / BLOCKBITS);
+	if (numBlocks == 0)
+		numBlocks = 1;
+	double hashes = std::floor((double)numBlocks * BLOCKBITS / expectedKeys * ln2 + 0.5);
+	numHashes = (std::uint32_t)std::max(1.0, std::min(16.0, hashes));
+	numKeys = 0;
+	words.assign((size_t)numBlocks * BLOCKWORDS, 0);
+}
+
+size_t BloomFilter::blockOffset(int key, std::uint64_t& hash) const
+{
+	hash = hashKey(key);
+	// multiply-shift maps the upper half of the hash onto the blocks
+	std::uint64_t block = ((hash >> 32) * numBlocks) >> 32;
+	return (size_t)block * BLOCKWORDS;
+}
+
+void BloomFilter::insert(int key)
+{
+	std::uint64_t hash;
+	std::uint64_t* block = &words[blockOffset(key, hash)];
+
+	// double hashing on the lower half picks the bits inside the block
+	std::uint32_t h1 = (std::uint32_t)hash & 0xffff;
+	std::uint32_t h2 = (((std::uint32_t)hash >> 16) & 0xffff) | 1;
+	for (std::uint32_t i = 0; i < numHashes; i++) {
+		std::uint32_t bit = (h1 + i * h2) % BLOCKBITS;
+		block[bit / 64] |= (std::uint64_t)1 << (bit % 64);
+	}
+	numKeys++;
+}
+
+bool BloomFilter::mayContain(int key) const
+{
+	std::uint64_t hash;
+	const std::uint64_t* block = &words[blockOffset(key, hash)];
+
+	std::uint32_t h1 = (std::uint32_t)hash & 0xffff;
+	std::uint32_t h2 = (((std::uint32_t)hash >> 16) & 0xffff) | 1;
+	for (std::uint32_t i = 0; i < numHashes; i++) {
+		std::uint32_t bit = (h1 + i * h2) % BLOCKBITS;
+		if (!(block[bit / 64] & ((std::uint64_t)1 << (bit % 64))))
+			return false;
+	}
+	return true;
+}
+
+bool BloomFilter::save(const std::string& fileName, std::uint32_t stamp) const
+{
+	std::ofstream out(fileName.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+	out.write(reinterpret_cast<const char*>(&BLOOM_FILE_MAGIC), sizeof(BLOOM_FILE_MAGIC));
+	out.write(reinterpret_cast<const char*>(&stamp), sizeof(stamp));
+	out.write(reinterpret_cast<const char*>(&numBlocks), sizeof(numBlocks));
+	out.write(reinterpret_cast<const char*>(&numHashes), sizeof(numHashes));
+	out.write(reinterpret_cast<const char*>(&numKeys), sizeof(numKeys));
+	out.write(reinterpret_cast<const char*>(&words[0]), words.size() * sizeof(std::uint64_t));
+	return (bool)out;
+}
+
+bool BloomFilter::load(const std::string& fileName, std::uint32_t stamp)
+{
+	std::ifstream in(fileName.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+
+	std::uint32_t magic, savedStamp, blocks, hashes;
+	std::uint64_t keys;
+	in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	in.read(reinterpret_cast<char*>(&savedStamp), sizeof(savedStamp));
+	in.read(reinterpret_cast<char*>(&blocks), sizeof(blocks));
+	in.read(reinterpret_cast<char*>(&hashes), sizeof(hashes));
+	in.read(reinterpret_cast<char*>(&keys), sizeof(keys));
+	if (!in || magic != BLOOM_FILE_MAGIC || savedStamp != stamp || blocks == 0)
+		return false;
+
+	std::vector<std::uint64_t> bits((size_t)blocks * BLOCKWORDS);
+	in.read(reinterpret_cast<char*>(&bits[0]), bits.size() * sizeof(std::uint64_t));
+	if (!in)
+		return false;
+
+	words.swap(bits);
+	numBlocks = blocks;
+	numHashes = hashes;
+	numKeys = keys;
+	return true;
+}
+
+std::size_t BloomFilter::memoryBytes() const
+{
+	return words.size() * sizeof(std::uint64_t);
+}
+
+double BloomFilter::falsePositiveRate() const
+{
+	// (1 - e^(-kn/m))^k; blocking makes the real rate slightly higher
+	double m = (double)numBlocks * BLOCKBITS;
+	return std::pow(1.0 - std::exp(-(double)numHashes * numKeys / m), (double)numHashes);
+}
+
+std::uint64_t BloomFilter::keyCount() const
+{
+	return numKeys;
+}
+
+}
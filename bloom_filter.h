@@ -0,0 +1,116 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace badgerdb
+{
+
+/**
+ * @brief Blocked Bloom filter over INTEGER keys.
+ * The bits of a key all lie in one 512-bit block (a cache line), so a probe touches a single cache line.
+ * It answers "definitely not present" or "maybe present"; BTreeIndex uses it to turn away lookups for
+ * absent keys before walking the tree.
+*/
+class BloomFilter {
+
+ private:
+
+  /**
+   * Bits of the filter, BLOCKWORDS words per block.
+   */
+	std::vector<std::uint64_t>	words;
+
+  /**
+   * Number of 512-bit blocks.
+   */
+	std::uint32_t	numBlocks;
+
+  /**
+   * Number of bits set per key.
+   */
+	std::uint32_t	numHashes;
+
+  /**
+   * Number of keys inserted.
+   */
+	std::uint64_t	numKeys;
+
+  /**
+   * Offset in words of the block of a key. Also returns the hash to pick bits inside the block from.
+   */
+	size_t blockOffset(int key, std::uint64_t& hash) const;
+
+ public:
+
+  /**
+   * Number of 64-bit words in a block.
+   */
+	static const int BLOCKWORDS = 8;
+
+  /**
+   * Number of bits in a block.
+   */
+	static const int BLOCKBITS = BLOCKWORDS * 64;
+
+  /**
+   * Constructor. Sizes the filter so that the false positive rate is about falsePositiveRate
+   * once expectedKeys keys have been inserted.
+   *
+   * @param expectedKeys				Number of keys the filter is sized for
+   * @param falsePositiveRate		Target rate of absent keys reported as maybe present, between 0 and 1
+   */
+	BloomFilter(std::uint64_t expectedKeys, double falsePositiveRate);
+
+  /**
+   * Add a key to the filter.
+   */
+	void insert(int key);
+
+  /**
+   * False if the key was never inserted, true if it may have been.
+   */
+	bool mayContain(int key) const;
+
+  /**
+   * Write the filter to a file, replacing it.
+   * @param fileName	File to write
+   * @param stamp			Stored with the filter, tells which state of the indexed data it covers
+   * @return	False if the file could not be written.
+   */
+	bool save(const std::string& fileName, std::uint32_t stamp) const;
+
+  /**
+   * Replace the filter with the one stored in a file by save().
+   * @param fileName	File to read
+   * @param stamp			Stamp the filter has to have been saved with
+   * @return	False, leaving the filter unchanged, if the file is missing, not a filter or has another stamp.
+   */
+	bool load(const std::string& fileName, std::uint32_t stamp);
+
+  /**
+   * Bytes taken by the bits of the filter.
+   */
+	std::size_t memoryBytes() const;
+
+  /**
+   * Expected false positive rate with the keys inserted so far.
+   */
+	double falsePositiveRate() const;
+
+  /**
+   * Number of keys inserted.
+   */
+	std::uint64_t keyCount() const;
+};
+
+}
@@ -5,6 +5,13 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "btree.h"
 #include "filescan.h"
 #include "exceptions/bad_index_info_exception.h"
@@ -15,6 +22,8 @@
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/index_read_only_exception.h"
+#include "exceptions/trace_unsupported_exception.h"
 
 //#define DEBUG
 
@@ -29,11 +38,12 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		std::string & outIndexName,
 		BufMgr *bufMgrIn,
 		const int attrByteOffset,
-		const Datatype attrType)
+		const Datatype attrType,
+		const IndexOptions& options)
 {
 	 // create index name
    std:: ostringstream idxStr;
-   idxStr << relationName << '.' << attrByteOffset;
+   idxStr << relationName << '.' << attrByteOffset << options.indexNameSuffix;
    std::string indexName = idxStr.str();
    std::cout << "Index name created: " << indexName << std::endl;
 
@@ -44,14 +54,72 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
    this->attrByteOffset = attrByteOffset;
    leafOccupancy = INTARRAYLEAFSIZE; //Do it for string and double
    nodeOccupancy = INTARRAYNONLEAFSIZE;
+   compressedLeaves = false;
+   nonLeafSearchBlock = false;
+   if (options.insertBufferSize < 0)
+     throw BadIndexInfoException("insertBufferSize must not be negative");
+   deltaCapacity = (options.openMode == READ_ONLY_MAPPED) ? 0 : options.insertBufferSize;
+   deltaSortedCount = 0;
+   openMode = options.openMode;
+   mappedFd = -1;
+   mappedData = NULL;
+   mappedSize = 0;
+   bloomFilter = NULL;
+   traceRecorder = NULL;
+   bloomFileName = indexName + ".bloom";
+   bloomStamp = 0;
+   std::uint32_t savedBloomStamp = 0;
+   bool createdIndex = false;
    scanExecuting = false;
+   scanReturnedEntry = false;
    is_root_leaf = true; //when the index does not exist, the root will be leaf 
-
+   lastLeafPageNum = 0; // no leaf to insert into directly until the first descent
+   reorganizing = false;
+   reorgSourcePageNum = 0;
+   freeListHead = 0;
+
+
+   if (openMode == READ_ONLY_MAPPED) {
+      // read-only: map the existing file and read pages straight from the mapping
+      if (!(File::exists(indexName)))
+         throw FileNotFoundException(indexName);
+      file = NULL;
+      // BlobFile pages are numbered from 1 (slot 0 holds the file header), the meta page comes first;
+      // the mapping checks that the file holds it
+      headerPageNum = 1;
+      rootPageNum = 0;
+      mapIndexFile(indexName);
+      std::cout << "Index file mapped read-only" << std::endl;
+
+      const IndexMetaInfo* metaInfo = reinterpret_cast<const IndexMetaInfo*>(mappedPage(headerPageNum));
+      this->attrByteOffset = metaInfo->attrByteOffset;
+      attributeType = metaInfo->attrType;
+      rootPageNum = metaInfo->rootPageNo;
+      compressedLeaves = (metaInfo->leafFormat == COMPRESSED_LEAF);
+      setLeafFormat();
+      nonLeafSearchBlock = (metaInfo->nonLeafLayout == SEARCH_BLOCK_NONLEAF);
+      setNonLeafLayout();
+      setNodeCapacities(metaInfo->leafCapacity, metaInfo->nonLeafCapacity);
+      is_root_leaf = (rootPageNum == 2);
+      // nothing changes the index, so a filter saved with its stamp stays valid
+      bloomStamp = metaInfo->bloomStamp;
+      savedBloomStamp = bloomStamp;
+      freeListHead = metaInfo->freeListHead;
 
    // check if this index file already exists or not.
-   if (!(File::exists(indexName))) {
+   } else if (!(File::exists(indexName))) {
       std::cout << "Index file does not exist" << std::endl;
       file = new BlobFile(indexName, true);
+      createdIndex = true;
+      compressedLeaves = options.compressLeaves;
+
+      // a filter left by an earlier index of the same name holds other keys
+      std::remove(bloomFileName.c_str());
+      nonLeafSearchBlock = options.nonLeafSearchBlock;
+
+      // the filter has to exist before the build so that it sees every key
+      if (options.bloomExpectedKeys > 0)
+         bloomFilter = new BloomFilter(options.bloomExpectedKeys, options.bloomFalsePositiveRate);
 
 
       //allocate new meta page
@@ -71,34 +139,51 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
       metaInfo->attrByteOffset = attrByteOffset;
       metaInfo->attrType = attributeType;
       metaInfo->rootPageNo = rootPageNum;
+      metaInfo->leafFormat = compressedLeaves ? COMPRESSED_LEAF : PLAIN_LEAF;
+      setLeafFormat();
+      metaInfo->nonLeafLayout = nonLeafSearchBlock ? SEARCH_BLOCK_NONLEAF : FLAT_NONLEAF;
+      setNonLeafLayout();
+      setNodeCapacities(options.leafNodeCapacity, options.nonLeafNodeCapacity);
+      metaInfo->leafCapacity = leafOccupancy;
+      metaInfo->nonLeafCapacity = nodeOccupancy;
+      bloomStamp = 1;
+      metaInfo->bloomStamp = bloomStamp;
+      metaInfo->freeListHead = 0;
 
 
       // for a new btree file, this should be a leaf node
-      LeafNodeInt* root = reinterpret_cast< LeafNodeInt* >(rootPage); //should check the type and do this for string/double/integer
-      root->rightSibPageNo = 0;      
+      if (compressedLeaves) {
+        encodeLeaf(rootPage, NULL, NULL, 0, 0);
+      } else {
+        LeafNodeInt* root = reinterpret_cast< LeafNodeInt* >(rootPage); //should check the type and do this for string/double/integer
+        root->rightSibPageNo = 0;      
+      }
 
       bufMgr->unPinPage(file, rootPageNum, true);
       bufMgr->unPinPage(file, headerPageNum, true);
       //scan records and insert into the Btree
-      FileScan fscan(relationName, bufMgr);
-      try
-      {
-        RecordId scanRid;
-        while (1)
-	{
-	   //scannext
-               fscan.scanNext(scanRid);
-               std::string recordStr = fscan.getRecord();
-               const char *record = recordStr.c_str();
-               void* key = (void *)(record + attrByteOffset); //typecast should be specific to attrType - change this later while making changes for all types
-	   //insertEntry
-              insertEntry(key,scanRid);
-	}
-      }
-      catch(EndOfFileException e)
-      {
-         std::cout << "Read relation and creating index file" << std::endl;	
+      if (options.buildFromRelation) {
+        FileScan fscan(relationName, bufMgr);
+        try
+        {
+          RecordId scanRid;
+          while (1)
+	  {
+	     //scannext
+                 fscan.scanNext(scanRid);
+                 std::string recordStr = fscan.getRecord();
+                 const char *record = recordStr.c_str();
+                 void* key = (void *)(record + attrByteOffset); //typecast should be specific to attrType - change this later while making changes for all types
+	     //insertEntry
+                insertEntry(key,scanRid);
+	  }
+        }
+        catch(EndOfFileException e)
+        {
+           std::cout << "Read relation and creating index file" << std::endl;	
+        }
       }
+      flushInsertBuffer();
       bufMgr->flushFile(file);
       
    } else {
@@ -118,6 +203,18 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
       this->attrByteOffset = metaInfo->attrByteOffset;
       attributeType = metaInfo->attrType;
       rootPageNum = metaInfo->rootPageNo;
+      compressedLeaves = (metaInfo->leafFormat == COMPRESSED_LEAF);
+      setLeafFormat();
+      nonLeafSearchBlock = (metaInfo->nonLeafLayout == SEARCH_BLOCK_NONLEAF);
+      setNonLeafLayout();
+      setNodeCapacities(metaInfo->leafCapacity, metaInfo->nonLeafCapacity);
+      // the index may change from here on without the filter seeing it (it
+      // may not be kept, or the index not closed), so the stored filter is
+      // only valid with the stamp it was saved with before
+      savedBloomStamp = metaInfo->bloomStamp;
+      bloomStamp = savedBloomStamp + 1;
+      metaInfo->bloomStamp = bloomStamp;
+      freeListHead = metaInfo->freeListHead;
      		
       //read the root page (bufMgr->readPage(file, rootpageNum, out_root_page)
       Page* out_root_page;
@@ -125,12 +222,23 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
       //Root page starts as page 2 but since a split can occur
       //* at the root the root page may get moved up and get a new page no.
       // So, if a root page number is 2, it is a leaf node.
-      if (rootPageNum == 2) {
-	is_root_leaf = true;
-      }
-      bufMgr->unPinPage(file, headerPageNum, false);
+      is_root_leaf = (rootPageNum == 2);
+      bufMgr->unPinPage(file, rootPageNum, false);
+      bufMgr->unPinPage(file, headerPageNum, true);
       
    }
+
+   if (!createdIndex)
+      openBloomFilter(options, savedBloomStamp);
+   if (bloomFilter != NULL)
+      std::cout << "Bloom filter: " << bloomFilterMemory() << " bytes, estimated false positive rate "
+                << bloomFilterFalsePositiveRate() << std::endl;
+
+   // the build above is not part of the traced workload, only its result
+   if (!options.traceFileName.empty()) {
+      traceRecorder = new TraceRecorder(options.traceFileName);
+      traceContent();
+   }
 }
 
 
@@ -140,7 +248,34 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 
 BTreeIndex::~BTreeIndex()
 {
-    
+    // what follows is not a call made on the index
+    delete traceRecorder;
+    traceRecorder = NULL;
+    // a pinned scan page would make the flush fail
+    if (scanExecuting)
+        endScan();
+    if (openMode == READ_ONLY_MAPPED) {
+        delete bloomFilter;
+        munmap(mappedData, mappedSize);
+        close(mappedFd);
+        return;
+    }
+    if (bloomFilter != NULL) {
+        bloomFilter->save(bloomFileName, bloomStamp);
+        delete bloomFilter;
+    }
+    // an unfinished reorganization is dropped, the current tree stays;
+    // the leaves it wrote so far go on the free list (there are no
+    // non-leaf nodes over them yet)
+    if (reorganizing) {
+        std::vector<PageId> reorgPageNos;
+        for (size_t i = 0; i < reorgLeaves.size(); i++)
+            reorgPageNos.push_back(reorgLeaves[i].pageNo);
+        reorganizing = false;
+        reorgLeaves.clear();
+        freeIndexPages(reorgPageNos);
+    }
+    flushInsertBuffer();
     bufMgr->flushFile(file);
     delete file;
     scanExecuting = false;
@@ -151,7 +286,7 @@ BTreeIndex::~BTreeIndex()
  * Simple lookup function to find the pageid of the leaf where
  * a given rid,key pair is to be inserted.
 */
-const void BTreeIndex::lookupLeaf(PageId currPageNo, RIDKeyPair<int> entry, PageKeyPair<int>& insertedPage)
+const void BTreeIndex::lookupLeaf(PageId currPageNo, RIDKeyPair<int> entry, PageKeyPair<int>& insertedPage, KeyRange<int> range)
 {
 	// Fetch current page for further traversal
 	Page *currPage;
@@ -164,17 +299,19 @@ const void BTreeIndex::lookupLeaf(PageId currPageNo, RIDKeyPair<int> entry, Page
 
 	// Find the index position in current node's page array of the next
 	//  child page to be traversed.
-	int idx = 0;
-	for (idx = 0; (currNode->pageNoArray[idx] != 0) && (idx < nodeOccupancy); idx++) {
-		if ((currNode->keyArray[idx] > entry.key))
-			break;
+	// child index position, i.e. the count of keys not greater than the key
+	int idx = nonLeafChildIndex(currNode, entry.key, true);
+
+	// narrow the key range down to the one of the child: the keys on
+	// either side of its page number, unless it is the first/last child
+	if (idx > 0) {
+		range.low = currNode->keyArray[idx-1];
+		range.hasLow = true;
+	}
+	if (idx < nonLeafKeyCount(currNode)) {
+		range.high = currNode->keyArray[idx];
+		range.hasHigh = true;
 	}
-
-	// if the above loop terminated because valid pages ended,
-	// decrease index by 1
-	if (currNode->pageNoArray[idx] == 0)
-		if (idx > 0)
-	    	   idx--;
 
 	// get the page number of the child
 	PageId nextLevelPageNo = currNode->pageNoArray[idx];
@@ -188,15 +325,21 @@ const void BTreeIndex::lookupLeaf(PageId currPageNo, RIDKeyPair<int> entry, Page
 		// If the leaf node is full, split it, else put the
 		// entry in leaf
 		bufMgr->readPage(file, nextLevelPageNo, nextLevelPage);
-		LeafNodeInt* nextLevelLeafNode = reinterpret_cast<LeafNodeInt*>(nextLevelPage);
-		if ((nextLevelLeafNode->ridArray[leafOccupancy-1]).page_number == 0) {
-			insertEntryInLeaf(nextLevelLeafNode, entry);
+		if (insertEntryInLeafPage(nextLevelPage, entry)) {
+			// remember the leaf so that following keys of its range skip the descent
+			lastLeafPageNum = nextLevelPageNo;
+			lastLeafRange = range;
 		} else {
+			// the split changes the leaf's range, so it can not be reused
+			lastLeafPageNum = 0;
 			// split the node and return the page info through newPage
-			splitLeafNode(nextLevelLeafNode, entry, newPage);
-			// insert page info in the current node
+			splitLeafPage(nextLevelPage, entry, newPage);
+			// insert page info in the current node, splitting it as well
+			// if it is full
 			if (currNode->pageNoArray[nodeOccupancy] == 0) {
-				insertEntryInNonLeaf(currNode, newPage);
+				insertEntryInNonLeaf(currNode, idx, newPage);
+			} else {
+				splitNonLeafNode(currNode, idx, newPage, insertedPage);
 			}
 		}
 		bufMgr->unPinPage(file, nextLevelPageNo, true); 
@@ -209,19 +352,21 @@ const void BTreeIndex::lookupLeaf(PageId currPageNo, RIDKeyPair<int> entry, Page
 	PageKeyPair<int> newInsertedPage;
 	newInsertedPage.set(0,0);
 	bufMgr->unPinPage(file,currPageNo,false); 
-	lookupLeaf(nextLevelPageNo, entry, newInsertedPage);
+	lookupLeaf(nextLevelPageNo, entry, newInsertedPage, range);
 
 	// do while traversing upwards
 	Page* readThisPage;
 	PageKeyPair<int> anotherNewPage;
 	bufMgr->readPage(file,currPageNo,readThisPage);
+	// the page may have been read into another frame
+	currNode = reinterpret_cast<NonLeafNodeInt*> (readThisPage);
 
 	if (newInsertedPage.pageNo != 0) {
 		newPage.set(newInsertedPage.pageNo, newInsertedPage.key);
 		if (currNode->pageNoArray[nodeOccupancy]==0) {
-			insertEntryInNonLeaf(currNode, newPage);
+			insertEntryInNonLeaf(currNode, idx, newPage);
   		}  else {
-  			splitNonLeafNode(currNode, newPage, anotherNewPage);
+  			splitNonLeafNode(currNode, idx, newPage, anotherNewPage);
 			insertedPage = anotherNewPage;
   		}
   	}
@@ -241,19 +386,12 @@ const void BTreeIndex::insertLeafAtNode(RIDKeyPair<int> entry){
         Page* currentPage;
         bufMgr->readPage(file, rootPageNum, currentPage);
         PageId prevRoot = rootPageNum;
-        LeafNodeInt* leafNode = reinterpret_cast<LeafNodeInt*> (currentPage);
-        int is_root_leaf_full = (leafNode->ridArray[leafOccupancy-1].page_number != 0);
 
         // Simple insert if the required leaf is not already full.
-        if(!is_root_leaf_full){
-                //leafNode->keyArray[index] = *((int*) key);
-                //leafNode->ridArray[index] = rid;
-                insertEntryInLeaf(leafNode, entry);
-        }
-        // Split and insert called if the required leaf is full.
-        else{
+        if(!insertEntryInLeafPage(currentPage, entry)){
+                // Split and insert called if the required leaf is full.
                 PageKeyPair<int> newPage;
-                splitLeafNode(leafNode, entry, newPage);
+                splitLeafPage(currentPage, entry, newPage);
                 makeNewRootNode(rootPageNum, newPage, true);
         }
 
@@ -261,41 +399,245 @@ const void BTreeIndex::insertLeafAtNode(RIDKeyPair<int> entry){
 }
 
 
+/*
+ * Fast path for inserts: put the entry in the leaf the previous insert
+ * went into if the key belongs to that leaf and there is room for it.
+ * Append-style inserts (growing keys) hit the same leaf until it is full.
+*/
+bool BTreeIndex::insertInLastLeaf(RIDKeyPair<int> entry)
+{
+	if (lastLeafPageNum == 0 || !lastLeafRange.contains(entry.key))
+		return false;
+
+	Page* leafPage;
+	bufMgr->readPage(file, lastLeafPageNum, leafPage);
+
+	// a full leaf has to be split, which needs its parent, so take the descent
+	bool inserted = insertEntryInLeafPage(leafPage, entry);
+	bufMgr->unPinPage(file, lastLeafPageNum, inserted);
+	return inserted;
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::insertEntry
 // -----------------------------------------------------------------------------
 
 const void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
+{
+	TraceScope trace(traceRecorder, TRACE_INSERT);
+	if (traceRecorder != NULL) {
+		trace.record.key = *((int*)key);
+		trace.record.pageNumber = rid.page_number;
+		trace.record.slotNumber = rid.slot_number;
+	}
+
+	if (openMode == READ_ONLY_MAPPED)
+		throw IndexReadOnlyException();
+	// Insert only if the index is Integer type
+	if (attributeType != INTEGER){
+		std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
+		trace.returned();
+		return;
+	}
+
+	RIDKeyPair<int> entry;
+	entry.set(rid, *((int*)(key)));
+	if (bloomFilter != NULL)
+		bloomFilter->insert(entry.key);
+
+	if (scanExecuting) {
+		// a running scan has a leaf pinned and its entries at hand, so the
+		// entry waits in the buffer whatever its capacity, where the scan
+		// takes it up if it is ahead of it, until endScan merges it
+		bufferEntryInScan(entry);
+	} else if (reorganizing) {
+		// the tree is being copied: entries wait in the buffer for the new one
+		bufferEntry(entry);
+	} else if (deltaCapacity > 0) {
+		// hold the entry back in the insert buffer
+		bufferEntry(entry);
+		if (deltaKeys.size() >= deltaCapacity)
+			flushInsertBuffer();
+	} else {
+		insertEntryInTree(entry);
+	}
+	trace.returned();
+}
+
+/*
+ * Insert an entry into the tree itself, bypassing the insert buffer.
+*/
+const void BTreeIndex::insertEntryInTree(RIDKeyPair<int> entry)
 {
 	if(is_root_leaf){
-		// Insert only if the index is Integer type
-		if (attributeType != INTEGER){
-			std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
-		} else{
-			RIDKeyPair<int> entry;
-			entry.set(rid, *((int*)(key)));
-			BTreeIndex::insertLeafAtNode(entry);
-		}
-	} else{
-		if (attributeType != INTEGER){
-			std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
-		} else{
-			RIDKeyPair<int> entry;
-			entry.set(rid, *((int*)(key)));
-			PageKeyPair<int> insertedPage;
-			insertedPage.set(0,entry.key);
-			BTreeIndex::lookupLeaf(rootPageNum, entry, insertedPage);
-			//create a new root if needed
-			PageId prevRoot = rootPageNum;
-			Page* rootPage;
-			bufMgr->readPage(file, prevRoot, rootPage);
-			if (insertedPage.pageNo != 0) {
-				makeNewRootNode(prevRoot, insertedPage, false);
+		BTreeIndex::insertLeafAtNode(entry);
+		return;
+	}
+
+	// keys that belong to the last leaf inserted into go straight there
+	if (insertInLastLeaf(entry))
+		return;
+	PageKeyPair<int> insertedPage;
+	insertedPage.set(0,entry.key);
+	// the root covers every key
+	KeyRange<int> range;
+	range.set(false, 0, false, 0);
+	BTreeIndex::lookupLeaf(rootPageNum, entry, insertedPage, range);
+	//create a new root if needed
+	PageId prevRoot = rootPageNum;
+	Page* rootPage;
+	bufMgr->readPage(file, prevRoot, rootPage);
+	if (insertedPage.pageNo != 0) {
+		makeNewRootNode(prevRoot, insertedPage, false);
+	}
+	bufMgr->unPinPage(file, prevRoot, true);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::bufferEntry
+// keep an entry in the insert buffer
+// -----------------------------------------------------------------------------
+const void BTreeIndex::bufferEntry(RIDKeyPair<int> entry)
+{
+	// appended unsorted, sortInsertBuffer() puts it in place when the
+	// buffer is next read
+	deltaKeys.push_back(entry.key);
+	deltaRids.push_back(entry.rid);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::bufferEntryInScan
+// keep an entry in the insert buffer a scan is running over
+// -----------------------------------------------------------------------------
+const void BTreeIndex::bufferEntryInScan(RIDKeyPair<int> entry)
+{
+	// startScan sorted the buffer, and it has stayed sorted since; the
+	// entry goes after the ones with the same key
+	size_t pos = std::upper_bound(deltaKeys.begin(), deltaKeys.end(), entry.key) - deltaKeys.begin();
+	deltaKeys.insert(deltaKeys.begin() + pos, entry.key);
+	deltaRids.insert(deltaRids.begin() + pos, entry.rid);
+	deltaSortedCount++;
+
+	// The scan only takes up an entry that is not behind what it returned
+	// already: one after a buffered entry it has yet to return, or one
+	// within the low bound not below the last key returned. Anything else
+	// ends up before the scan position.
+	bool ahead = pos > deltaScanPos
+		|| (pos == deltaScanPos && scanKeyAboveLow(entry.key)
+			&& (!scanReturnedEntry || entry.key >= scanLastKey));
+	if (!ahead) {
+		deltaScanPos++;
+		deltaScanEnd++;
+	} else if (pos < deltaScanEnd || (pos == deltaScanEnd && scanKeyInRange(entry.key))) {
+		deltaScanEnd++;
+	}
+}
+
+/*
+ * Orders positions of the insert buffer by their keys.
+*/
+struct DeltaKeyLess{
+	const std::vector<int>& keys;
+
+	DeltaKeyLess(const std::vector<int>& keys) : keys(keys) {}
+
+	bool operator()(size_t a, size_t b) const { return keys[a] < keys[b]; }
+};
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::sortInsertBuffer
+// bring the entries appended since the last call into key order
+// -----------------------------------------------------------------------------
+const void BTreeIndex::sortInsertBuffer()
+{
+	size_t n = deltaKeys.size();
+	if (deltaSortedCount == n)
+		return;
+
+	// sort the appended entries and merge them in after the sorted ones;
+	// both steps are stable, so entries with the same key keep their
+	// insert order
+	std::vector<size_t> order(n);
+	for (size_t i = 0; i < n; i++)
+		order[i] = i;
+	DeltaKeyLess less(deltaKeys);
+	std::stable_sort(order.begin() + deltaSortedCount, order.end(), less);
+	std::inplace_merge(order.begin(), order.begin() + deltaSortedCount, order.end(), less);
+
+	std::vector<int> keys(n);
+	std::vector<RecordId> rids(n);
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = deltaKeys[order[i]];
+		rids[i] = deltaRids[order[i]];
+	}
+	deltaKeys.swap(keys);
+	deltaRids.swap(rids);
+	deltaSortedCount = n;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::flushInsertBuffer
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::flushInsertBuffer()
+{
+	// the entries have to wait for the tree being built
+	if (reorganizing)
+		return;
+
+	// the scan position refers to the buffer
+	if (scanExecuting)
+		endScan();
+
+	sortInsertBuffer();
+	size_t n = deltaKeys.size();
+	size_t i = 0;
+	while (i < n) {
+		// the buffer is sorted, so consecutive entries fall into the leaf
+		// the previous insert went into: pin it once for the whole run
+		if (!is_root_leaf && lastLeafPageNum != 0 && lastLeafRange.contains(deltaKeys[i])) {
+			PageId leafPageNo = lastLeafPageNum;
+			Page* leafPage;
+			bufMgr->readPage(file, leafPageNo, leafPage);
+			size_t runStart = i;
+			while (i < n && lastLeafRange.contains(deltaKeys[i])) {
+				RIDKeyPair<int> entry;
+				entry.set(deltaRids[i], deltaKeys[i]);
+				if (!insertEntryInLeafPage(leafPage, entry))
+					break;
+				i++;
 			}
-			bufMgr->unPinPage(file, prevRoot, true);
+			bufMgr->unPinPage(file, leafPageNo, i > runStart);
+			if (i == n)
+				break;
 		}
+
+		// first entry of the next leaf, or the leaf is full and has to
+		// be split: take the descent, which remembers the new leaf
+		RIDKeyPair<int> entry;
+		entry.set(deltaRids[i], deltaKeys[i]);
+		insertEntryInTree(entry);
+		i++;
 	}
 
+	deltaKeys.clear();
+	deltaRids.clear();
+	deltaSortedCount = 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::flush
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::flush()
+{
+	if (openMode == READ_ONLY_MAPPED)
+		return;
+	// a pinned scan page would make the flush fail
+	if (scanExecuting)
+		endScan();
+	flushInsertBuffer();
+	bufMgr->flushFile(file);
 }
 
 // -----------------------------------------------------------------------------
@@ -325,28 +667,23 @@ void BTreeIndex::insertEntryInLeaf(LeafNodeInt* leafNode, RIDKeyPair<int> entry)
 // BTreeIndex::insertEntryInNonLeaf
 // insert entry in non leaf
 // ----------------------------------------------------------------------------
-void BTreeIndex::insertEntryInNonLeaf(NonLeafNodeInt* nonLeafNode, PageKeyPair<int> entry){
-    //find the position in the leaf node for the entry
-    int idx;
-    for (idx = 0; ((nonLeafNode->pageNoArray[idx]) != 0 && (idx < leafOccupancy)); idx++) {
-      if (nonLeafNode->keyArray[idx] >= entry.key)
-        break;
-    }
+void BTreeIndex::insertEntryInNonLeaf(NonLeafNodeInt* nonLeafNode, int childIdx, PageKeyPair<int> entry){
+    // the new page goes right after the child at childIdx it was split off,
+    // its key in front of it. Searching for the key instead could put it
+    // on the wrong side of separators equal to it, as leaf splits leave
+    // equal keys on both sides of the key they push up.
+    int idx = childIdx;
 
     // shift the entries to the right 
-    for (int i = leafOccupancy - 1; i > idx; i--){
+    for (int i = nodeOccupancy - 1; i > idx; i--){
       nonLeafNode->keyArray[i] = nonLeafNode->keyArray[i-1];
       nonLeafNode->pageNoArray[i+1] = nonLeafNode->pageNoArray[i];
     }
 
-    // insert the entry in either last or on the position found
-    if (nonLeafNode->pageNoArray[idx] == 0) {
-        nonLeafNode->pageNoArray[idx] = entry.pageNo;
-	nonLeafNode->keyArray[idx-1] = entry.key;
-    } else {
-	nonLeafNode->pageNoArray[idx+1] = entry.pageNo;
-	nonLeafNode->keyArray[idx] = entry.key;
-    }
+    // insert the entry on the position found
+    nonLeafNode->pageNoArray[idx+1] = entry.pageNo;
+    nonLeafNode->keyArray[idx] = entry.key;
+    rebuildSearchBlock(nonLeafNode);
 }
 
 const void BTreeIndex::makeNewRootNode(PageId pid, PageKeyPair<int> pageKey, bool setlevel){
@@ -354,7 +691,7 @@ const void BTreeIndex::makeNewRootNode(PageId pid, PageKeyPair<int> pageKey, boo
 	// allocate a new page
 	Page* newRootPage;
 	PageId newRootPageNo;
-	bufMgr->allocPage(file, newRootPageNo, newRootPage);
+	allocIndexPage(newRootPageNo, newRootPage);
 
 	// set values in the new node
 	NonLeafNodeInt* newRootNode = (NonLeafNodeInt*)newRootPage;
@@ -362,6 +699,7 @@ const void BTreeIndex::makeNewRootNode(PageId pid, PageKeyPair<int> pageKey, boo
 	newRootNode->pageNoArray[0] = pid;
 	newRootNode->pageNoArray[1] = pageKey.pageNo;
 	newRootNode->keyArray[0] = pageKey.key;
+	rebuildSearchBlock(newRootNode);
 
 	// make changes to root page info and metapage
 	rootPageNum = newRootPageNo;
@@ -386,7 +724,7 @@ const void BTreeIndex::splitLeafNode(LeafNodeInt* leafNode, RIDKeyPair<int> entr
     //allocate new page
     PageId PageNo;
     Page* Page;
-    bufMgr->allocPage(file, PageNo, Page);
+    allocIndexPage(PageNo, Page);
 
     // cast it as new leaf node
     LeafNodeInt* newNode = reinterpret_cast<LeafNodeInt*>(Page);	
@@ -423,190 +761,1642 @@ const void BTreeIndex::splitLeafNode(LeafNodeInt* leafNode, RIDKeyPair<int> entr
  * the required non leaf was determined to be full.
  *
 */
-const void BTreeIndex::splitNonLeafNode(NonLeafNodeInt* nonLeafNode, PageKeyPair<int> entry, PageKeyPair<int>& newInsertedPage) {
+const void BTreeIndex::splitNonLeafNode(NonLeafNodeInt* nonLeafNode, int childIdx, PageKeyPair<int> entry, PageKeyPair<int>& newInsertedPage) {
     //allocate new page
     PageId newPageNo;
     Page* newPage;
-    bufMgr->allocPage(file, newPageNo, newPage);
+    allocIndexPage(newPageNo, newPage);
 
     // cast it as new nonleaf node
     NonLeafNodeInt* newNode = reinterpret_cast<NonLeafNodeInt*>(newPage);	
 
-    // find mid point
-    int mid = nodeOccupancy/2+1;
+    // lay out all keys and pages including the new entry, which goes
+    // right after the child at childIdx (as in insertEntryInNonLeaf)
+    std::vector<int> keys(nonLeafNode->keyArray, nonLeafNode->keyArray + nodeOccupancy);
+    std::vector<PageId> pageNos(nonLeafNode->pageNoArray, nonLeafNode->pageNoArray + nodeOccupancy + 1);
+    int idx = childIdx;
+    keys.insert(keys.begin() + idx, entry.key);
+    pageNos.insert(pageNos.begin() + idx + 1, entry.pageNo);
+
+    // find mid point: the key there moves up to the parent and is kept in
+    // neither node, the keys around it separate the children on each side
+    int mid = (nodeOccupancy + 1) / 2;
 
     // set the level
     newNode->level = nonLeafNode->level; 
 
     // assign values for separation
-    for (int i = mid; i < nodeOccupancy; i++) {
-	newNode->keyArray[i-mid] = nonLeafNode->keyArray[i];
-	newNode->pageNoArray[i-mid] = nonLeafNode->pageNoArray[i];
-    }
-    // set page array correctly
-    newNode->pageNoArray[nodeOccupancy-mid] = nonLeafNode->pageNoArray[nodeOccupancy];
-    nonLeafNode->pageNoArray[nodeOccupancy] = 0;
-
-    // decide where to insert	
-    if (entry.key < newNode->keyArray[0]){
-	insertEntryInNonLeaf(nonLeafNode, entry);
-    } else{
-	insertEntryInNonLeaf(newNode, entry);
+    for (int i = 0; i <= nodeOccupancy; i++) {
+	nonLeafNode->pageNoArray[i] = (i <= mid) ? pageNos[i] : 0;
+	newNode->pageNoArray[i] = (mid + 1 + i <= nodeOccupancy + 1) ? pageNos[mid + 1 + i] : 0;
     }
+    for (int i = 0; i < mid; i++)
+	nonLeafNode->keyArray[i] = keys[i];
+    for (int i = mid + 1; i <= nodeOccupancy; i++)
+	newNode->keyArray[i - mid - 1] = keys[i];
+    rebuildSearchBlock(nonLeafNode);
+    rebuildSearchBlock(newNode);
 
     // set the values for return
-    newInsertedPage.set(newPageNo,newNode->keyArray[0]);
+    newInsertedPage.set(newPageNo, keys[mid]);
     bufMgr->unPinPage(file, newPageNo, true);
 }
 
-const void BTreeIndex::findStartRecordID(Page *rootPage){
-        NonLeafNodeInt *node;
-        node = (NonLeafNodeInt*)rootPage;
-        if(node->level == 0) // Leaf node
-        {
-                int i = 0;
-                while(i < INTARRAYLEAFSIZE-1){
-                        if(lowOp == GT && lowValInt > node->keyArray[i]){
-                                // Pin page in the buffer pool
-                                currentPageNum = node->pageNoArray[i];
-                                bufMgr->allocPage(file, currentPageNum, currentPageData);
-                                nextEntry = i;
-                                return;
-                        }
-                        else if(lowOp == GTE && lowValInt >= node->keyArray[i]){
-                                  // Pin page in the buffer pool
-                                  // set the current page number
-                                  // Set the current page and pin it 
-                                currentPageNum = node->pageNoArray[i];
-                                bufMgr->allocPage(file, currentPageNum, currentPageData);
-                                nextEntry = i;
-                                return;
-                      }
-                        i++;
-                }
-                // No node was found // throw exception
-                throw NoSuchKeyFoundException();
-        }
-        else{
-                // Non - leaf node
-                int i = 0;
-                while(lowOp == GT && i < INTARRAYNONLEAFSIZE-1 && lowValInt > node->keyArray[i]){
-                                i++;
-                        }
-                while(lowOp == GTE && i < INTARRAYNONLEAFSIZE-1 && lowValInt >= node->keyArray[i]){
-                                i++;
-                }
-                Page* page;
-// This may not always be in the buffer 
-                bufMgr->readPage(file, node->pageNoArray[i], page);
-                findStartRecordID(page);
-        }
-}
-
 // -----------------------------------------------------------------------------
-// BTreeIndex::startScan
+// Leaf formats
 // -----------------------------------------------------------------------------
 
-const void BTreeIndex::startScan(const void* lowValParm,
-				   const Operator lowOpParm,
-				   const void* highValParm,
-				   const Operator highOpParm)
+/*
+ * Set up leaf capacity and scratch space for the leaf format in use.
+*/
+const void BTreeIndex::setLeafFormat()
 {
-	// Check for errors
-        if(scanExecuting == true)
-                endScan();
-        scanExecuting = true;
-        if(lowOpParm != GT || lowOpParm != GTE)
-                throw BadOpcodesException();
-        if(highOpParm != LT || highOpParm != LTE)
-                throw BadOpcodesException();
-        if(highValParm < lowValParm)
-                throw BadScanrangeException();
-        if(attributeType == 0)// Integer keys
-        {
-                lowValInt = *(int*)lowValParm;
-                highValInt = *(int*) highValParm;
-        }
-        else if(attributeType == 1){
-                lowValDouble = *(double*)lowValParm;
-                highValDouble = *(double*)highValParm;
-        }
-        else if(attributeType == 2)
-        {
-                lowValString = *(char*)lowValParm;
-                highValString = *(char*) highValParm;
-        }
+	if (compressedLeaves) {
+		leafOccupancy = COMPRESSEDLEAFMAXSIZE;
+		// one extra slot for the entry being inserted into a full leaf
+		leafKeyBuffer.resize(COMPRESSEDLEAFMAXSIZE + 1);
+		leafRidBuffer.resize(COMPRESSEDLEAFMAXSIZE + 1);
+		scanKeyBuffer.resize(COMPRESSEDLEAFMAXSIZE);
+		scanRidBuffer.resize(COMPRESSEDLEAFMAXSIZE);
+	} else {
+		leafOccupancy = INTARRAYLEAFSIZE;
+	}
+}
 
-        lowOp = lowOpParm;
-        highOp = highOpParm;
-        // Do we need to do this for everydata type?
-        Page *rootPage;
-        bufMgr->readPage(file, rootPageNum, rootPage); // read the root node 
+/*
+ * Number of bits needed to store values up to maxValue.
+*/
+static int bitWidth(std::uint32_t maxValue)
+{
+	int bits = 0;
+	while (maxValue != 0) {
+		bits++;
+		maxValue >>= 1;
+	}
+	return bits;
+}
 
-        // Linear search on the keys array to find the page to traverse to next page
-        findStartRecordID(rootPage);
-        // Find the first page set up the value
+/*
+ * Pack count values of the given width, back to back, starting at out.
+ * Values are or-ed in through unaligned 64-bit words, so 8 bytes past the
+ * last packed byte have to be writable and zeroed.
+*/
+static void packBits(unsigned char* out, const std::uint32_t* values, int count, int bits)
+{
+	for (int i = 0; i < count; i++) {
+		std::uint64_t bitPos = (std::uint64_t)i * bits;
+		std::uint64_t word;
+		memcpy(&word, out + (bitPos >> 3), sizeof(word));
+		word |= (std::uint64_t)values[i] << (bitPos & 7);
+		memcpy(out + (bitPos >> 3), &word, sizeof(word));
+	}
 }
 
-// -----------------------------------------------------------------------------
-// BTreeIndex::scanNext
-// -----------------------------------------------------------------------------
+/*
+ * Unpack count values of the given width packed by packBits.
+ * The loop has no branches and a fixed stride, so the compiler can
+ * unroll and vectorize it.
+*/
+static void unpackBits(const unsigned char* in, std::uint32_t* values, int count, int bits)
+{
+	std::uint64_t mask = ((std::uint64_t)1 << bits) - 1;
+	for (int i = 0; i < count; i++) {
+		std::uint64_t bitPos = (std::uint64_t)i * bits;
+		std::uint64_t word;
+		memcpy(&word, in + (bitPos >> 3), sizeof(word));
+		values[i] = (std::uint32_t)((word >> (bitPos & 7)) & mask);
+	}
+}
 
-const void BTreeIndex::scanNext(RecordId& outRid) 
+/*
+ * Bytes taken by count packed values of the given width.
+*/
+static int packedSize(int count, int bits)
 {
-	if(scanExecuting == false)
-                throw ScanNotInitializedException();
+	return (count * bits + 7) / 8;
+}
+
+int BTreeIndex::decodeLeaf(const Page* leafPage, int* keys, RecordId* rids) const
+{
+	const CompressedLeafNodeInt* leafNode = reinterpret_cast<const CompressedLeafNodeInt*>(leafPage);
+	int count = leafNode->count;
+	int keyBits = leafNode->bitWidths[0];
+	int pageNoBits = leafNode->bitWidths[1];
+	int slotBits = leafNode->bitWidths[2];
+
+	const unsigned char* keyData = leafNode->data;
+	const unsigned char* pageNoData = keyData + packedSize(count, keyBits);
+	const unsigned char* slotData = pageNoData + packedSize(count, pageNoBits);
+
+	// Decode each stream in one pass, then add the bases back
+	std::uint32_t values[COMPRESSEDLEAFMAXSIZE];
+	unpackBits(keyData, values, count, keyBits);
+	for (int i = 0; i < count; i++)
+		keys[i] = (int)((std::uint32_t)leafNode->keyBase + values[i]);
+
+	unpackBits(pageNoData, values, count, pageNoBits);
+	for (int i = 0; i < count; i++)
+		rids[i].page_number = leafNode->pageNoBase + values[i];
+
+	unpackBits(slotData, values, count, slotBits);
+	for (int i = 0; i < count; i++)
+		rids[i].slot_number = (SlotId)values[i];
+
+	return count;
+}
 
-        LeafNodeInt *currentPage = (LeafNodeInt*) currentPageData;
+bool BTreeIndex::encodeLeaf(Page* leafPage, const int* keys, const RecordId* rids, int count, PageId rightSibPageNo) const
+{
+	if (count > leafOccupancy)
+		return false;
+
+	// Frame of reference: keys are sorted, RecordIds are not
+	int keyBase = (count > 0) ? keys[0] : 0;
+	std::uint32_t keySpan = (count > 0) ? (std::uint32_t)keys[count-1] - (std::uint32_t)keyBase : 0;
+	PageId pageNoBase = (count > 0) ? rids[0].page_number : 0;
+	PageId pageNoMax = pageNoBase;
+	SlotId slotMax = 0;
+	for (int i = 0; i < count; i++) {
+		if (rids[i].page_number < pageNoBase)
+			pageNoBase = rids[i].page_number;
+		if (rids[i].page_number > pageNoMax)
+			pageNoMax = rids[i].page_number;
+		if (rids[i].slot_number > slotMax)
+			slotMax = rids[i].slot_number;
+	}
 
-        if(highOp == LT  && currentPage->keyArray[nextEntry] <  highValInt ){ // Satisfies the condition 
-                outRid = currentPage->ridArray[nextEntry];
-                nextEntry++;
-        }
-        else if(highOp == LTE && currentPage->keyArray[nextEntry] <= highValInt ){
-                outRid = currentPage->ridArray[nextEntry];
-                nextEntry++;
-        }
-        else{
-                // No More records found 
-                throw IndexScanCompletedException();
-        }
-        if(nextEntry >= INTARRAYLEAFSIZE) // Move to the next page if exists
-        {
-                // Unpin the older page 
-                bufMgr->unPinPage(file, currentPageNum, false); // Assuming that once the records are generated we just read from them 
-                currentPageNum = currentPage->rightSibPageNo;
-                bufMgr->allocPage(file, currentPageNum, currentPageData);
-        }
+	int keyBits = bitWidth(keySpan);
+	int pageNoBits = bitWidth(pageNoMax - pageNoBase);
+	int slotBits = bitWidth(slotMax);
+
+	// 8 spare bytes for the 64-bit loads and stores of the last values
+	int keyBytes = packedSize(count, keyBits);
+	int pageNoBytes = packedSize(count, pageNoBits);
+	int slotBytes = packedSize(count, slotBits);
+	int dataBytes = keyBytes + pageNoBytes + slotBytes + 8;
+	if (dataBytes > COMPRESSEDLEAFDATASIZE)
+		return false;
+
+	CompressedLeafNodeInt* leafNode = reinterpret_cast<CompressedLeafNodeInt*>(leafPage);
+	leafNode->count = count;
+	leafNode->keyBase = keyBase;
+	leafNode->bitWidths[0] = keyBits;
+	leafNode->bitWidths[1] = pageNoBits;
+	leafNode->bitWidths[2] = slotBits;
+	leafNode->bitWidths[3] = 0;
+	leafNode->pageNoBase = pageNoBase;
+	leafNode->rightSibPageNo = rightSibPageNo;
+	memset(leafNode->data, 0, dataBytes);
+
+	std::uint32_t values[COMPRESSEDLEAFMAXSIZE];
+	for (int i = 0; i < count; i++)
+		values[i] = (std::uint32_t)keys[i] - (std::uint32_t)keyBase;
+	packBits(leafNode->data, values, count, keyBits);
+
+	for (int i = 0; i < count; i++)
+		values[i] = rids[i].page_number - pageNoBase;
+	packBits(leafNode->data + keyBytes, values, count, pageNoBits);
+
+	for (int i = 0; i < count; i++)
+		values[i] = rids[i].slot_number;
+	packBits(leafNode->data + keyBytes + pageNoBytes, values, count, slotBits);
+
+	return true;
+}
+
+const void BTreeIndex::readLeafEntries(Page* leafPage, std::vector<int>& keyBuffer, std::vector<RecordId>& ridBuffer, LeafEntrySpan<int>& outEntries) const
+{
+	if (compressedLeaves) {
+		int count = decodeLeaf(leafPage, &keyBuffer[0], &ridBuffer[0]);
+		outEntries.set(&keyBuffer[0], &ridBuffer[0], count);
+		return;
+	}
+
+	LeafNodeInt* leafNode = reinterpret_cast<LeafNodeInt*>(leafPage);
+	int count;
+	for (count = 0; count < leafOccupancy; count++) {
+		if (leafNode->ridArray[count].page_number == 0)
+			break;
+	}
+	outEntries.set(leafNode->keyArray, leafNode->ridArray, count);
+}
+
+PageId BTreeIndex::leafRightSibling(const Page* leafPage) const
+{
+	if (compressedLeaves)
+		return reinterpret_cast<const CompressedLeafNodeInt*>(leafPage)->rightSibPageNo;
+	return reinterpret_cast<const LeafNodeInt*>(leafPage)->rightSibPageNo;
+}
+
+bool BTreeIndex::insertEntryInLeafPage(Page* leafPage, RIDKeyPair<int> entry)
+{
+	if (!compressedLeaves) {
+		LeafNodeInt* leafNode = reinterpret_cast<LeafNodeInt*>(leafPage);
+		if (leafNode->ridArray[leafOccupancy-1].page_number != 0)
+			return false;
+		insertEntryInLeaf(leafNode, entry);
+		return true;
+	}
+
+	int* keys = &leafKeyBuffer[0];
+	RecordId* rids = &leafRidBuffer[0];
+	int count = decodeLeaf(leafPage, keys, rids);
+	if (count >= leafOccupancy)
+		return false;
+
+	// same position as insertEntryInLeaf: before the first key not smaller
+	int idx = std::lower_bound(keys, keys + count, entry.key) - keys;
+	for (int i = count; i > idx; i--) {
+		keys[i] = keys[i-1];
+		rids[i] = rids[i-1];
+	}
+	keys[idx] = entry.key;
+	rids[idx] = entry.rid;
+
+	// the wider RecordIds of the new entry may not fit any more
+	return encodeLeaf(leafPage, keys, rids, count + 1, leafRightSibling(leafPage));
 }
 
+const void BTreeIndex::splitLeafPage(Page* leafPage, RIDKeyPair<int> entry, PageKeyPair<int>& newPage)
+{
+	if (!compressedLeaves) {
+		splitLeafNode(reinterpret_cast<LeafNodeInt*>(leafPage), entry, newPage);
+		return;
+	}
+
+	int* keys = &leafKeyBuffer[0];
+	RecordId* rids = &leafRidBuffer[0];
+	int count = decodeLeaf(leafPage, keys, rids);
+	PageId rightSibPageNo = leafRightSibling(leafPage);
+
+	int idx = std::lower_bound(keys, keys + count, entry.key) - keys;
+	for (int i = count; i > idx; i--) {
+		keys[i] = keys[i-1];
+		rids[i] = rids[i-1];
+	}
+	keys[idx] = entry.key;
+	rids[idx] = entry.rid;
+	count++;
+
+	//allocate new page
+	PageId newPageNo;
+	Page* newLeafPage;
+	allocIndexPage(newPageNo, newLeafPage);
+
+	// COMPRESSEDLEAFMAXSIZE is chosen so that both halves always fit
+	int mid = count / 2;
+	encodeLeaf(newLeafPage, keys + mid, rids + mid, count - mid, rightSibPageNo);
+	encodeLeaf(leafPage, keys, rids, mid, newPageNo);
 
+	// set entry for return
+	newPage.set(newPageNo, keys[mid]);
+
+	bufMgr->unPinPage(file, newPageNo, true);
+}
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::endScan
+// Non-leaf layouts and node capacities
 // -----------------------------------------------------------------------------
-//
-const void BTreeIndex::endScan() 
+
+/*
+ * Set up non-leaf capacity for the layout in nonLeafSearchBlock. The search
+ * block takes the last key slots of keyArray, so those are not available
+ * for keys.
+*/
+const void BTreeIndex::setNonLeafLayout()
 {
-	/ If no scan is initialized 
-        if(!scanExecuting){
-                throw ScanNotInitializedException();
-        }
-        else{
-                // A scan is currently executing 
-                // Reset all the scan variables
-                //Unpin pinned pages
-                bufMgr->unPinPage(file, currentPageNum, false);
-                scanExecuting = false;
-                nextEntry = -1;
-                currentPageNum = -1;
-                //lowOp = NULL; // how to deal with these operators ?
-                //highOp = NULL;
-                // the high and lower values must be reset
-        }
+	nodeOccupancy = nonLeafSearchBlock ? INTARRAYNONLEAFSIZE - NONLEAFSEARCHBLOCKSIZE : INTARRAYNONLEAFSIZE;
+}
+
+static const int* searchBlockOf(const NonLeafNodeInt* node)
+{
+	return node->keyArray + INTARRAYNONLEAFSIZE - NONLEAFSEARCHBLOCKSIZE;
+}
 
+static int* searchBlockOf(NonLeafNodeInt* node)
+{
+	return node->keyArray + INTARRAYNONLEAFSIZE - NONLEAFSEARCHBLOCKSIZE;
+}
+
+/*
+ * Number of keys in use in a non-leaf node with room for occupancy keys:
+ * one less than the number of child pages, found by binary search for the
+ * first unused page slot.
+*/
+static int usedKeySlots(const NonLeafNodeInt* node, int occupancy)
+{
+	int lo = 1;
+	int hi = occupancy + 1;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (node->pageNoArray[mid] != 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+/*
+ * Step forward from begin over the sorted keys below key (or below or equal
+ * to it), stopping at end. The run is at most one cache line long.
+*/
+static int skipKeysBelow(const int* keys, int begin, int end, int key, bool orEqual)
+{
+	while (begin < end && (orEqual ? keys[begin] <= key : keys[begin] < key))
+		begin++;
+	return begin;
+}
+
+/*
+ * Child index for a key in a node with a search block. The block holds the
+ * key count, the top fences (every NONLEAFSEARCHLINE-th mid fence) and the
+ * mid fences (every NONLEAFSEARCHLINE-th key). If t top fences lie below the
+ * key, the number of mid fences below it is between the index of the last
+ * of them plus one and the index of the next one, a run of one cache line;
+ * the same holds for the keys under the mid fences. So the search reads the
+ * head of the block, one line of mid fences and one line of keys.
+*/
+static int searchBlockChildIndex(const NonLeafNodeInt* node, int key, bool orEqual)
+{
+	const int* block = searchBlockOf(node);
+	int nKeys = block[0];
+	int nMid = (nKeys + NONLEAFSEARCHLINE - 1) / NONLEAFSEARCHLINE;
+	int nTop = (nMid + NONLEAFSEARCHLINE - 1) / NONLEAFSEARCHLINE;
+	const int* top = block + 1;
+	const int* mid = top + NONLEAFSEARCHTOPSIZE;
+
+	int topBelow = skipKeysBelow(top, 0, nTop, key, orEqual);
+	if (topBelow == 0)
+		return 0;
+	int midStart = NONLEAFSEARCHLINE * (topBelow - 1);
+	int midBelow = skipKeysBelow(mid, midStart + 1, std::min(midStart + NONLEAFSEARCHLINE, nMid), key, orEqual);
+	int keyStart = NONLEAFSEARCHLINE * (midBelow - 1);
+	return skipKeysBelow(node->keyArray, keyStart + 1, std::min(keyStart + NONLEAFSEARCHLINE, nKeys), key, orEqual);
+}
+
+/*
+ * Number of keys in a non-leaf node.
+*/
+int BTreeIndex::nonLeafKeyCount(const NonLeafNodeInt* node) const
+{
+	if (nonLeafSearchBlock)
+		return searchBlockOf(node)[0];
+	return usedKeySlots(node, nodeOccupancy);
+}
+
+int BTreeIndex::nonLeafChildIndex(const NonLeafNodeInt* node, int key, bool orEqual) const
+{
+	if (nonLeafSearchBlock)
+		return searchBlockChildIndex(node, key, orEqual);
+	const int* keys = node->keyArray;
+	int nKeys = usedKeySlots(node, nodeOccupancy);
+	if (orEqual)
+		return std::upper_bound(keys, keys + nKeys, key) - keys;
+	return std::lower_bound(keys, keys + nKeys, key) - keys;
+}
+
+/*
+ * Clamp a requested capacity to [MINNODECAPACITY, maxCapacity], 0 meaning
+ * maxCapacity.
+*/
+static int clampCapacity(const char* what, int capacity, int maxCapacity)
+{
+	if (capacity == 0)
+		return maxCapacity;
+	if (capacity > maxCapacity) {
+		std::cout << what << " capacity " << capacity << " does not fit in a page, using " << maxCapacity << std::endl;
+		return maxCapacity;
+	}
+	if (capacity < MINNODECAPACITY) {
+		std::cout << what << " capacity " << capacity << " is too small, using " << MINNODECAPACITY << std::endl;
+		return MINNODECAPACITY;
+	}
+	return capacity;
 }
 
+const void BTreeIndex::setNodeCapacities(int leafCapacity, int nonLeafCapacity)
+{
+	leafOccupancy = clampCapacity("Leaf", leafCapacity, leafOccupancy);
+	nodeOccupancy = clampCapacity("Non-leaf", nonLeafCapacity, nodeOccupancy);
+}
+
+const void BTreeIndex::rebuildSearchBlock(NonLeafNodeInt* node)
+{
+	if (!nonLeafSearchBlock)
+		return;
+	int* block = searchBlockOf(node);
+	int nKeys = usedKeySlots(node, nodeOccupancy);
+	int nMid = (nKeys + NONLEAFSEARCHLINE - 1) / NONLEAFSEARCHLINE;
+	int nTop = (nMid + NONLEAFSEARCHLINE - 1) / NONLEAFSEARCHLINE;
+	int* top = block + 1;
+	int* mid = top + NONLEAFSEARCHTOPSIZE;
+
+	block[0] = nKeys;
+	for (int j = 0; j < nMid; j++)
+		mid[j] = node->keyArray[NONLEAFSEARCHLINE * j];
+	for (int t = 0; t < nTop; t++)
+		top[t] = mid[NONLEAFSEARCHLINE * t];
+}
+
+// -----------------------------------------------------------------------------
+// Bloom filter
+// -----------------------------------------------------------------------------
+
+/*
+ * Load the Bloom filter stored next to an existing index file. If there
+ * is none but one is asked for, build it from the keys in the leaves.
+*/
+const void BTreeIndex::openBloomFilter(const IndexOptions& options, std::uint32_t savedStamp)
+{
+	if (File::exists(bloomFileName)) {
+		bloomFilter = new BloomFilter(1, options.bloomFalsePositiveRate);
+		if (!bloomFilter->load(bloomFileName, savedStamp)) {
+			std::cout << "Bloom filter file " << bloomFileName << " is not valid or out of date, ignoring it" << std::endl;
+			delete bloomFilter;
+			bloomFilter = NULL;
+		}
+	}
+
+	if (bloomFilter == NULL && options.bloomExpectedKeys > 0) {
+		bloomFilter = new BloomFilter(options.bloomExpectedKeys, options.bloomFalsePositiveRate);
+		buildBloomFilter();
+	}
+}
+
+/*
+ * Add every key in the leaves to the Bloom filter, walking the leaves
+ * from left to right.
+*/
+const void BTreeIndex::buildBloomFilter()
+{
+	std::vector<int> keyBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+	std::vector<RecordId> ridBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+
+	PageId pageNo = findLeftmostLeaf();
+	while (pageNo != 0) {
+		Page* page;
+		fetchPage(pageNo, page);
+		LeafEntrySpan<int> entries;
+		readLeafEntries(page, keyBuffer, ridBuffer, entries);
+		for (int i = 0; i < entries.count; i++)
+			bloomFilter->insert(entries.keys[i]);
+		PageId sibPageNo = leafRightSibling(page);
+		releasePage(pageNo);
+		pageNo = sibPageNo;
+	}
+}
+
+std::size_t BTreeIndex::bloomFilterMemory() const
+{
+	return (bloomFilter != NULL) ? bloomFilter->memoryBytes() : 0;
+}
+
+double BTreeIndex::bloomFilterFalsePositiveRate() const
+{
+	return (bloomFilter != NULL) ? bloomFilter->falsePositiveRate() : 1.0;
+}
+
+// -----------------------------------------------------------------------------
+// Trace
+// -----------------------------------------------------------------------------
+
+/*
+ * The insert buffer is still empty when the index has just been opened,
+ * so the leaves hold every entry.
+*/
+const void BTreeIndex::traceContent()
+{
+	std::vector<int> keyBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+	std::vector<RecordId> ridBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+	TraceRecord record;
+	memset(&record, 0, sizeof(record));
+	record.op = TRACE_LOAD;
+
+	PageId pageNo = findLeftmostLeaf();
+	while (pageNo != 0) {
+		Page* page;
+		fetchPage(pageNo, page);
+		LeafEntrySpan<int> entries;
+		readLeafEntries(page, keyBuffer, ridBuffer, entries);
+		for (int i = 0; i < entries.count; i++) {
+			record.key = entries.keys[i];
+			record.pageNumber = entries.rids[i].page_number;
+			record.slotNumber = entries.rids[i].slot_number;
+			traceRecorder->write(record);
+		}
+		PageId sibPageNo = leafRightSibling(page);
+		releasePage(pageNo);
+		pageNo = sibPageNo;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Page access for lookups and scans
+// -----------------------------------------------------------------------------
+
+/*
+ * Map the whole index file read-only for READ_ONLY_MAPPED mode.
+*/
+/*
+ * Byte offset of a page in a BlobFile, as BlobFile::pagePosition computes
+ * it: the file header takes the first page-sized slot and page n sits at
+ * n * Page::SIZE.
+*/
+static size_t blobFilePageOffset(PageId pageNo)
+{
+	return (size_t)pageNo * Page::SIZE;
+}
+
+const void BTreeIndex::mapIndexFile(const std::string& indexName)
+{
+	mappedFd = open(indexName.c_str(), O_RDONLY);
+	if (mappedFd < 0)
+		throw FileNotFoundException(indexName);
+
+	// the file has to hold at least the meta page
+	struct stat fileStat;
+	if (fstat(mappedFd, &fileStat) != 0 || fileStat.st_size < (off_t)blobFilePageOffset(headerPageNum + 1)) {
+		close(mappedFd);
+		throw FileNotFoundException(indexName);
+	}
+	mappedSize = fileStat.st_size;
+	void* data = mmap(NULL, mappedSize, PROT_READ, MAP_SHARED, mappedFd, 0);
+	if (data == MAP_FAILED) {
+		close(mappedFd);
+		throw FileNotFoundException(indexName);
+	}
+	mappedData = static_cast<char*>(data);
+
+	// lookups jump from page to page, don't read ahead for them
+	madvise(mappedData, mappedSize, MADV_RANDOM);
+}
+
+/*
+ * Address of a page inside the mapping.
+*/
+Page* BTreeIndex::mappedPage(PageId pageNo) const
+{
+	return reinterpret_cast<Page*>(mappedData + blobFilePageOffset(pageNo));
+}
+
+/*
+ * Give the kernel an access hint for one page of the mapping.
+*/
+const void BTreeIndex::advisePage(PageId pageNo, int advice) const
+{
+	madvise(mappedPage(pageNo), Page::SIZE, advice);
+}
+
+/*
+ * Get a page for reading: pinned through the buffer manager, or a plain
+ * pointer into the mapping when the index is mapped read-only.
+*/
+const void BTreeIndex::fetchPage(PageId pageNo, Page*& page)
+{
+	if (openMode == READ_ONLY_MAPPED) {
+		page = mappedPage(pageNo);
+		return;
+	}
+	bufMgr->readPage(file, pageNo, page);
+}
+
+/*
+ * Done reading a page got through fetchPage.
+*/
+const void BTreeIndex::releasePage(PageId pageNo)
+{
+	if (openMode == READ_ONLY_MAPPED)
+		return;
+	bufMgr->unPinPage(file, pageNo, false);
+}
+
+/*
+ * Page number of the leftmost leaf, found by always taking the first child.
+*/
+PageId BTreeIndex::findLeftmostLeaf()
+{
+	PageId pageNo = rootPageNum;
+	if (is_root_leaf)
+		return pageNo;
+
+	while (true) {
+		Page* page;
+		fetchPage(pageNo, page);
+		NonLeafNodeInt* node = reinterpret_cast<NonLeafNodeInt*>(page);
+		PageId childPageNo = node->pageNoArray[0];
+		bool childIsLeaf = (node->level == 1);
+		releasePage(pageNo);
+		pageNo = childPageNo;
+		if (childIsLeaf)
+			return pageNo;
+	}
+}
+
+/*
+ * Descend from the root to the leftmost leaf that may hold a key satisfying
+ * the low bound of the scan, then step forward, across right siblings if
+ * needed, to the first such key. The leaf holding it stays pinned.
+*/
+const void BTreeIndex::findStartRecordID()
+{
+	PageId pageNo = rootPageNum;
+	Page* page;
+	fetchPage(pageNo, page);
+
+	if (!is_root_leaf) {
+		while (true) {
+			NonLeafNodeInt* node = reinterpret_cast<NonLeafNodeInt*>(page);
+
+			// skip children whose keys all lie below the low bound; keys equal
+			// to a separator may still sit in the child left of it
+			int idx = nonLeafChildIndex(node, lowValInt, lowOp == GT);
+
+			PageId childPageNo = node->pageNoArray[idx];
+			bool childIsLeaf = (node->level == 1);
+			releasePage(pageNo);
+			pageNo = childPageNo;
+			fetchPage(pageNo, page);
+			if (childIsLeaf)
+				break;
+		}
+	}
+
+	currentPageNum = pageNo;
+	currentPageData = page;
+	nextEntry = 0;
+	loadScanLeaf();
+
+	// move up to the first key satisfying the low bound
+	while (true) {
+		while (nextEntry < scanEntryCount && !scanKeyAboveLow(scanKeys[nextEntry]))
+			nextEntry++;
+		if (nextEntry < scanEntryCount)
+			break;
+		if (!advanceScanLeaf()) {
+			releasePage(currentPageNum);
+			throw NoSuchKeyFoundException();
+		}
+	}
+
+	if (!scanKeyInRange(scanKeys[nextEntry])) {
+		releasePage(currentPageNum);
+		throw NoSuchKeyFoundException();
+	}
+}
+
+/*
+ * Point scanKeys/scanRids at the entries of the leaf in currentPageData.
+*/
+const void BTreeIndex::loadScanLeaf()
+{
+	LeafEntrySpan<int> entries;
+	readLeafEntries(currentPageData, scanKeyBuffer, scanRidBuffer, entries);
+	scanKeys = entries.keys;
+	scanRids = entries.rids;
+	scanEntryCount = entries.count;
+}
+
+/*
+ * Move the scan to the right sibling of the current leaf. Returns false,
+ * keeping the current leaf pinned, if it is the last leaf.
+*/
+bool BTreeIndex::advanceScanLeaf()
+{
+	PageId sibPageNo = leafRightSibling(currentPageData);
+	if (sibPageNo == 0)
+		return false;
+
+	releasePage(currentPageNum);
+	currentPageNum = sibPageNo;
+	fetchPage(currentPageNum, currentPageData);
+	nextEntry = 0;
+	loadScanLeaf();
+
+	// have the kernel read the leaf after this one while this one is scanned
+	if (openMode == READ_ONLY_MAPPED && leafRightSibling(currentPageData) != 0)
+		advisePage(leafRightSibling(currentPageData), MADV_WILLNEED);
+	return true;
+}
+
+/*
+ * Make nextEntry point at the next tree entry of the scan, moving on to
+ * right siblings as needed. False once the tree has no more entries in range.
+*/
+bool BTreeIndex::treeScanEntryAvailable()
+{
+	// no leaf of the tree had entries in range to begin with
+	if (currentPageNum == 0)
+		return false;
+	while (nextEntry >= scanEntryCount) {
+		if (!advanceScanLeaf())
+			return false;
+	}
+	return scanKeyInRange(scanKeys[nextEntry]);
+}
+
+bool BTreeIndex::scanKeyAboveLow(int key) const
+{
+	return (lowOp == GT) ? key > lowValInt : key >= lowValInt;
+}
+
+bool BTreeIndex::scanKeyInRange(int key) const
+{
+	return (highOp == LT) ? key < highValInt : key <= highValInt;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookupBatch
+// -----------------------------------------------------------------------------
+
+/*
+ * State of one probe of lookupBatch on its way down the tree.
+*/
+struct BatchProbe{
+	int key;
+	size_t index;				// position of the key in the caller's array
+	PageId pageNo;			// node the probe is at
+	int lo, hi;					// binary search window over the node's keys
+};
+
+static bool probeKeyLess(const BatchProbe& p1, const BatchProbe& p2)
+{
+	return p1.key < p2.key;
+}
+
+/*
+ * Move every probe of a group sitting on the same non-leaf node to the
+ * leftmost child that may hold its key. The binary searches of the probes
+ * run in lockstep, one step of each per round, and every step prefetches
+ * the key the probe compares against next, so the cache misses of the
+ * probes overlap instead of being taken one after the other. A node with
+ * a search block is searched through it instead, one probe at a time.
+*/
+static void descendProbes(const NonLeafNodeInt* node, int nKeys, bool searchBlock, BatchProbe* probes, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		probes[i].lo = searchBlock ? searchBlockChildIndex(node, probes[i].key, false) : 0;
+		probes[i].hi = searchBlock ? probes[i].lo : nKeys;
+	}
+
+	bool searching = !searchBlock;
+	while (searching) {
+		searching = false;
+		for (size_t i = 0; i < count; i++) {
+			BatchProbe& probe = probes[i];
+			if (probe.lo >= probe.hi)
+				continue;
+			int mid = (probe.lo + probe.hi) / 2;
+			if (node->keyArray[mid] < probe.key)
+				probe.lo = mid + 1;
+			else
+				probe.hi = mid;
+			if (probe.lo < probe.hi) {
+				__builtin_prefetch(&node->keyArray[(probe.lo + probe.hi) / 2]);
+				searching = true;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < count; i++)
+		probes[i].pageNo = node->pageNoArray[probes[i].lo];
+}
+
+const void BTreeIndex::lookupBatch(const void* keys, const size_t n, std::vector<RecordId>& outRids, std::vector<size_t>& outOffsets)
+{
+	TraceScope trace(traceRecorder, TRACE_LOOKUP_BATCH);
+	outRids.clear();
+	outOffsets.assign(n + 1, 0);
+	if (attributeType != INTEGER){
+		std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
+		trace.returned();
+		return;
+	}
+	const int* probeKeys = (const int*)keys;
+	if (traceRecorder != NULL) {
+		trace.record.key = (std::int32_t)n;
+		trace.writeBatchKeys(probeKeys, n);
+	}
+
+	// Probes the Bloom filter rules out never touch the tree. The others
+	// are sorted so that probes sharing a node are next to each other.
+	std::vector<BatchProbe> probes;
+	probes.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		if (bloomFilter != NULL && !bloomFilter->mayContain(probeKeys[i]))
+			continue;
+		BatchProbe probe;
+		probe.key = probeKeys[i];
+		probe.index = i;
+		probe.pageNo = rootPageNum;
+		probes.push_back(probe);
+	}
+	std::stable_sort(probes.begin(), probes.end(), probeKeyLess);
+
+	// Walk down one level at a time with all probes. Each node is read once
+	// for all the probes passing through it.
+	bool leafLevel = is_root_leaf;
+	while (!leafLevel && !probes.empty()) {
+		size_t group = 0;
+		while (group < probes.size()) {
+			size_t groupEnd = group + 1;
+			while (groupEnd < probes.size() && probes[groupEnd].pageNo == probes[group].pageNo)
+				groupEnd++;
+
+			PageId pageNo = probes[group].pageNo;
+			Page* page;
+			fetchPage(pageNo, page);
+			const NonLeafNodeInt* node = reinterpret_cast<const NonLeafNodeInt*>(page);
+			leafLevel = (node->level == 1);
+			descendProbes(node, nonLeafKeyCount(node), nonLeafSearchBlock, &probes[group], groupEnd - group);
+			releasePage(pageNo);
+
+			// mapped pages can be prefetched before the next level needs them
+			if (openMode == READ_ONLY_MAPPED) {
+				for (size_t i = group; i < groupEnd; i++) {
+					if (i == group || probes[i].pageNo != probes[i-1].pageNo)
+						__builtin_prefetch(mappedPage(probes[i].pageNo));
+				}
+			}
+			group = groupEnd;
+		}
+	}
+
+	// Probes sharing a leaf share one pin of it
+	std::vector<int> keyBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+	std::vector<RecordId> ridBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+	std::vector<int> nextKeyBuffer(keyBuffer.size());
+	std::vector<RecordId> nextRidBuffer(ridBuffer.size());
+	std::vector< std::pair<size_t, RecordId> > matches;
+	size_t group = 0;
+	while (group < probes.size()) {
+		size_t groupEnd = group + 1;
+		while (groupEnd < probes.size() && probes[groupEnd].pageNo == probes[group].pageNo)
+			groupEnd++;
+
+		PageId pageNo = probes[group].pageNo;
+		Page* page;
+		fetchPage(pageNo, page);
+		LeafEntrySpan<int> entries;
+		readLeafEntries(page, keyBuffer, ridBuffer, entries);
+		PageId sibPageNo = leafRightSibling(page);
+
+		for (size_t i = group; i < groupEnd; i++) {
+			const BatchProbe& probe = probes[i];
+			int pos = std::lower_bound(entries.keys, entries.keys + entries.count, probe.key) - entries.keys;
+			while (pos < entries.count && entries.keys[pos] == probe.key) {
+				matches.push_back(std::make_pair(probe.index, entries.rids[pos]));
+				pos++;
+			}
+
+			// the next leaf can still hold the key as long as no greater
+			// key came up: runs of equal keys go on across leaves
+			bool mayGoOn = (pos == entries.count);
+			PageId nextPageNo = sibPageNo;
+			while (mayGoOn && nextPageNo != 0) {
+				Page* nextPage;
+				fetchPage(nextPageNo, nextPage);
+				LeafEntrySpan<int> nextEntries;
+				readLeafEntries(nextPage, nextKeyBuffer, nextRidBuffer, nextEntries);
+				int nextPos = std::lower_bound(nextEntries.keys, nextEntries.keys + nextEntries.count, probe.key) - nextEntries.keys;
+				while (nextPos < nextEntries.count && nextEntries.keys[nextPos] == probe.key) {
+					matches.push_back(std::make_pair(probe.index, nextEntries.rids[nextPos]));
+					nextPos++;
+				}
+				mayGoOn = (nextPos == nextEntries.count);
+				PageId followingPageNo = leafRightSibling(nextPage);
+				releasePage(nextPageNo);
+				nextPageNo = followingPageNo;
+			}
+		}
+		releasePage(pageNo);
+		group = groupEnd;
+	}
+
+	// Entries still in the insert buffer
+	sortInsertBuffer();
+	for (size_t i = 0; i < probes.size() && !deltaKeys.empty(); i++) {
+		std::vector<int>::const_iterator it = std::lower_bound(deltaKeys.begin(), deltaKeys.end(), probes[i].key);
+		for (; it != deltaKeys.end() && *it == probes[i].key; ++it)
+			matches.push_back(std::make_pair(probes[i].index, deltaRids[it - deltaKeys.begin()]));
+	}
+
+	// Lay the matches out by probe
+	for (size_t i = 0; i < matches.size(); i++)
+		outOffsets[matches[i].first + 1]++;
+	for (size_t i = 0; i < n; i++)
+		outOffsets[i + 1] += outOffsets[i];
+	outRids.resize(matches.size());
+	std::vector<size_t> fill(outOffsets.begin(), outOffsets.end() - 1);
+	for (size_t i = 0; i < matches.size(); i++)
+		outRids[fill[matches[i].first]++] = matches[i].second;
+	trace.returned();
+}
+
+// -----------------------------------------------------------------------------
+// Free list
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::allocIndexPage(PageId& pageNo, Page*& page)
+{
+	if (freeListHead == 0) {
+		bufMgr->allocPage(file, pageNo, page);
+		return;
+	}
+
+	pageNo = freeListHead;
+	bufMgr->readPage(file, pageNo, page);
+	freeListHead = reinterpret_cast<FreeIndexPage*>(page)->nextFreePageNo;
+	// the node code expects a page as allocPage hands it out
+	memset(page, 0, Page::SIZE);
+
+	Page* headerPage;
+	bufMgr->readPage(file, headerPageNum, headerPage);
+	reinterpret_cast<IndexMetaInfo*>(headerPage)->freeListHead = freeListHead;
+	bufMgr->unPinPage(file, headerPageNum, true);
+}
+
+/*
+ * The pages are pushed in descending order, so that allocIndexPage()
+ * hands them out in ascending order and nodes split off one after the
+ * other end up close together.
+*/
+const void BTreeIndex::freeIndexPages(std::vector<PageId>& pageNos)
+{
+	std::sort(pageNos.begin(), pageNos.end());
+	for (size_t i = pageNos.size(); i-- > 0; ) {
+		// a reopened index takes a root on page 2 for a leaf, so page 2
+		// must not come back as a new root
+		if (pageNos[i] == 2)
+			continue;
+		Page* page;
+		bufMgr->readPage(file, pageNos[i], page);
+		reinterpret_cast<FreeIndexPage*>(page)->nextFreePageNo = freeListHead;
+		bufMgr->unPinPage(file, pageNos[i], true);
+		freeListHead = pageNos[i];
+	}
+
+	Page* headerPage;
+	bufMgr->readPage(file, headerPageNum, headerPage);
+	reinterpret_cast<IndexMetaInfo*>(headerPage)->freeListHead = freeListHead;
+	bufMgr->unPinPage(file, headerPageNum, true);
+}
+
+const void BTreeIndex::collectTreePages(PageId pageNo, bool isLeaf, std::vector<PageId>& outPageNos)
+{
+	outPageNos.push_back(pageNo);
+	if (isLeaf)
+		return;
+
+	Page* page;
+	bufMgr->readPage(file, pageNo, page);
+	const NonLeafNodeInt* node = reinterpret_cast<const NonLeafNodeInt*>(page);
+	std::vector<PageId> children(node->pageNoArray, node->pageNoArray + nonLeafKeyCount(node) + 1);
+	bool childrenAreLeaves = (node->level == 1);
+	bufMgr->unPinPage(file, pageNo, false);
+
+	for (size_t i = 0; i < children.size(); i++)
+		collectTreePages(children[i], childrenAreLeaves, outPageNos);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::measureFragmentation
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::measureFragmentation(IndexFragmentation& outMetrics)
+{
+	outMetrics.leafCount = 0;
+	outMetrics.entryCount = 0;
+	outMetrics.averageLeafFill = 0;
+	outMetrics.discontiguousLinks = 0;
+	outMetrics.backwardLinks = 0;
+
+	std::vector<int> keyBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+	std::vector<RecordId> ridBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+
+	PageId pageNo = findLeftmostLeaf();
+	while (pageNo != 0) {
+		Page* page;
+		fetchPage(pageNo, page);
+		LeafEntrySpan<int> entries;
+		readLeafEntries(page, keyBuffer, ridBuffer, entries);
+		PageId sibPageNo = leafRightSibling(page);
+		releasePage(pageNo);
+
+		outMetrics.leafCount++;
+		outMetrics.entryCount += entries.count;
+		if (sibPageNo != 0 && sibPageNo != pageNo + 1)
+			outMetrics.discontiguousLinks++;
+		if (sibPageNo != 0 && sibPageNo < pageNo)
+			outMetrics.backwardLinks++;
+		pageNo = sibPageNo;
+	}
+
+	if (outMetrics.leafCount > 0)
+		outMetrics.averageLeafFill = (double)outMetrics.entryCount / ((double)outMetrics.leafCount * leafOccupancy);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startReorganize
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::startReorganize(double fillFactor)
+{
+	if (openMode == READ_ONLY_MAPPED)
+		throw IndexReadOnlyException();
+	if (attributeType != INTEGER){
+		std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
+		return;
+	}
+	if (reorganizing)
+		return;
+	if (!(fillFactor > 0 && fillFactor <= 1)) {
+		std::cout << "Fill factor " << fillFactor << " is not in (0, 1], using 1" << std::endl;
+		fillFactor = 1;
+	}
+
+	reorganizing = true;
+	reorgFillFactor = fillFactor;
+	reorgLeafFill = std::max(1, (int)(fillFactor * leafOccupancy));
+	reorgSourcePageNum = findLeftmostLeaf();
+	reorgKeys.clear();
+	reorgRids.clear();
+	reorgLeaves.clear();
+	// no leaf of the current tree is written to any more
+	lastLeafPageNum = 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::reorganizeStep
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::reorganizeStep(int maxLeaves)
+{
+	if (!reorganizing)
+		return true;
+
+	std::vector<int> keyBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+	std::vector<RecordId> ridBuffer(compressedLeaves ? COMPRESSEDLEAFMAXSIZE : 0);
+
+	for (int copied = 0; copied < maxLeaves && reorgSourcePageNum != 0; copied++) {
+		Page* page;
+		bufMgr->readPage(file, reorgSourcePageNum, page);
+		LeafEntrySpan<int> entries;
+		readLeafEntries(page, keyBuffer, ridBuffer, entries);
+		reorgKeys.insert(reorgKeys.end(), entries.keys, entries.keys + entries.count);
+		reorgRids.insert(reorgRids.end(), entries.rids, entries.rids + entries.count);
+		PageId sibPageNo = leafRightSibling(page);
+		bufMgr->unPinPage(file, reorgSourcePageNum, false);
+		reorgSourcePageNum = sibPageNo;
+
+		while ((int)reorgKeys.size() >= reorgLeafFill)
+			writeReorgLeaf(reorgLeafFill);
+	}
+	if (reorgSourcePageNum != 0)
+		return false;
+
+	// the scan holds a leaf of the current tree and the file is about to be flushed
+	if (scanExecuting)
+		return false;
+
+	if (reorgLeaves.empty() && reorgKeys.empty())
+		writeReorgLeaf(0);
+	while (!reorgKeys.empty())
+		writeReorgLeaf(reorgKeys.size());
+	PageId newRootPageNo = buildReorgInnerLevels();
+	PageId oldRootPageNo = rootPageNum;
+	bool oldRootIsLeaf = is_root_leaf;
+
+	// every page of the new tree is on disk before the meta page points to it
+	bufMgr->flushFile(file);
+	Page* headerPage;
+	bufMgr->readPage(file, headerPageNum, headerPage);
+	IndexMetaInfo* metaInfo = reinterpret_cast<IndexMetaInfo*>(headerPage);
+	metaInfo->rootPageNo = newRootPageNo;
+	rootPageNum = newRootPageNo;
+	is_root_leaf = false;
+	bufMgr->unPinPage(file, headerPageNum, true);
+	bufMgr->flushFile(file);
+
+	reorganizing = false;
+	reorgLeaves.clear();
+	lastLeafPageNum = 0;
+
+	// nothing refers to the old tree any more
+	std::vector<PageId> oldPageNos;
+	collectTreePages(oldRootPageNo, oldRootIsLeaf, oldPageNos);
+	freeIndexPages(oldPageNos);
+
+	// the entries inserted meanwhile
+	flushInsertBuffer();
+	bufMgr->flushFile(file);
+	return true;
+}
+
+/*
+ * Append a leaf with the first count pending entries. Pages are allocated
+ * at the end of the file, so consecutive leaves get consecutive pages.
+*/
+const void BTreeIndex::writeReorgLeaf(int count)
+{
+	PageId newPageNo;
+	Page* newPage;
+	bufMgr->allocPage(file, newPageNo, newPage);
+
+	if (compressedLeaves) {
+		// a full leaf of wide entries may not fit, half of one always does
+		while (!encodeLeaf(newPage, count > 0 ? &reorgKeys[0] : NULL, count > 0 ? &reorgRids[0] : NULL, count, 0))
+			count = (count + 1) / 2;
+	} else {
+		LeafNodeInt* leafNode = reinterpret_cast<LeafNodeInt*>(newPage);
+		for (int i = 0; i < count; i++) {
+			leafNode->keyArray[i] = reorgKeys[i];
+			leafNode->ridArray[i] = reorgRids[i];
+		}
+		leafNode->rightSibPageNo = 0;
+	}
+	bufMgr->unPinPage(file, newPageNo, true);
+
+	if (reorgLeaves.empty()) {
+		PageKeyPair<int> leaf;
+		leaf.set(newPageNo, count > 0 ? reorgKeys[0] : 0);
+		reorgLeaves.push_back(leaf);
+	} else {
+		// link the previous new leaf to this one
+		PageId prevPageNo = reorgLeaves.back().pageNo;
+		Page* prevPage;
+		bufMgr->readPage(file, prevPageNo, prevPage);
+		if (compressedLeaves)
+			reinterpret_cast<CompressedLeafNodeInt*>(prevPage)->rightSibPageNo = newPageNo;
+		else
+			reinterpret_cast<LeafNodeInt*>(prevPage)->rightSibPageNo = newPageNo;
+		bufMgr->unPinPage(file, prevPageNo, true);
+
+		PageKeyPair<int> leaf;
+		leaf.set(newPageNo, reorgKeys[0]);
+		reorgLeaves.push_back(leaf);
+	}
+
+	reorgKeys.erase(reorgKeys.begin(), reorgKeys.begin() + count);
+	reorgRids.erase(reorgRids.begin(), reorgRids.begin() + count);
+}
+
+/*
+ * Build the non-leaf levels bottom-up. The children of a level are spread
+ * evenly over as few nodes as hold them at the fill factor; the separator
+ * to the left of the first child of a node moves up to the next level.
+ * There is always at least one non-leaf level, so the root is never a leaf
+ * and never page 2.
+*/
+PageId BTreeIndex::buildReorgInnerLevels()
+{
+	int fanout = std::max(2, std::min(nodeOccupancy + 1, (int)(reorgFillFactor * (nodeOccupancy + 1))));
+	std::vector< PageKeyPair<int> > children(reorgLeaves);
+	int level = 1;
+
+	do {
+		size_t nodeCount = (children.size() + fanout - 1) / fanout;
+		size_t perNode = children.size() / nodeCount;
+		size_t extra = children.size() % nodeCount;
+
+		std::vector< PageKeyPair<int> > parents;
+		size_t first = 0;
+		for (size_t n = 0; n < nodeCount; n++) {
+			size_t count = perNode + (n < extra ? 1 : 0);
+			PageId newPageNo;
+			Page* newPage;
+			bufMgr->allocPage(file, newPageNo, newPage);
+			NonLeafNodeInt* node = reinterpret_cast<NonLeafNodeInt*>(newPage);
+			node->level = level;
+			for (size_t c = 0; c < count; c++) {
+				node->pageNoArray[c] = children[first + c].pageNo;
+				if (c > 0)
+					node->keyArray[c - 1] = children[first + c].key;
+			}
+			rebuildSearchBlock(node);
+			bufMgr->unPinPage(file, newPageNo, true);
+
+			PageKeyPair<int> parent;
+			parent.set(newPageNo, children[first].key);
+			parents.push_back(parent);
+			first += count;
+		}
+
+		children.swap(parents);
+		level = 0;
+	} while (children.size() > 1);
+
+	return children[0].pageNo;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::reorganize
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::reorganize(double fillFactor, IndexFragmentation& outBefore, IndexFragmentation& outAfter)
+{
+	if (scanExecuting)
+		endScan();
+	measureFragmentation(outBefore);
+	startReorganize(fillFactor);
+	while (!reorganizeStep(64))
+		;
+	measureFragmentation(outAfter);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startScan
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::startScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm)
+{
+	TraceScope trace(traceRecorder, TRACE_START_SCAN);
+	if (traceRecorder != NULL) {
+		trace.record.key = *(int*)lowValParm;
+		trace.record.high = *(int*)highValParm;
+		trace.record.lowOp = (std::uint8_t)lowOpParm;
+		trace.record.highOp = (std::uint8_t)highOpParm;
+	}
+
+	// Check for errors
+        if(scanExecuting == true)
+                endScan();
+        if(lowOpParm != GT && lowOpParm != GTE)
+                throw BadOpcodesException();
+        if(highOpParm != LT && highOpParm != LTE)
+                throw BadOpcodesException();
+        if(attributeType == 0)// Integer keys
+        {
+                lowValInt = *(int*)lowValParm;
+                highValInt = *(int*) highValParm;
+                if(lowValInt > highValInt)
+                        throw BadScanrangeException();
+        }
+        else if(attributeType == 1){
+                lowValDouble = *(double*)lowValParm;
+                highValDouble = *(double*)highValParm;
+        }
+        else if(attributeType == 2)
+        {
+                lowValString = *(char*)lowValParm;
+                highValString = *(char*) highValParm;
+        }
+
+        lowOp = lowOpParm;
+        highOp = highOpParm;
+
+        // A point lookup for a key the Bloom filter has never seen has nothing to find
+        if(bloomFilter != NULL && lowOp == GTE && highOp == LTE && lowValInt == highValInt
+                        && !bloomFilter->mayContain(lowValInt))
+                throw NoSuchKeyFoundException();
+
+        // Entries of the insert buffer within range, merged in by scanNext
+        sortInsertBuffer();
+        deltaScanPos = (lowOp == GT)
+                ? std::upper_bound(deltaKeys.begin(), deltaKeys.end(), lowValInt) - deltaKeys.begin()
+                : std::lower_bound(deltaKeys.begin(), deltaKeys.end(), lowValInt) - deltaKeys.begin();
+        deltaScanEnd = (highOp == LTE)
+                ? std::upper_bound(deltaKeys.begin(), deltaKeys.end(), highValInt) - deltaKeys.begin()
+                : std::lower_bound(deltaKeys.begin(), deltaKeys.end(), highValInt) - deltaKeys.begin();
+        if(deltaScanEnd < deltaScanPos)
+                deltaScanEnd = deltaScanPos;
+        scanReturnedEntry = false;
+
+        // Find the leaf holding the first matching entry and keep it pinned
+        try
+        {
+                findStartRecordID();
+        }
+        catch(NoSuchKeyFoundException e)
+        {
+                // the matching entries may all still be in the insert buffer
+                if(deltaScanPos == deltaScanEnd)
+                        throw;
+                currentPageNum = 0;
+                nextEntry = 0;
+                scanEntryCount = 0;
+        }
+        scanExecuting = true;
+
+        // A scan reads leaves along the sibling chain, let the kernel read ahead
+        if(openMode == READ_ONLY_MAPPED)
+                madvise(mappedData, mappedSize, MADV_SEQUENTIAL);
+        trace.returned();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNext
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::scanNext(RecordId& outRid) 
+{
+	TraceScope trace(traceRecorder, TRACE_SCAN_NEXT);
+	if(scanExecuting == false)
+                throw ScanNotInitializedException();
+
+        bool treeHasEntry = treeScanEntryAvailable();
+        bool deltaHasEntry = deltaScanPos < deltaScanEnd;
+        if(!treeHasEntry && !deltaHasEntry){
+                // No More records found 
+                throw IndexScanCompletedException();
+        }
+
+        // Merge the tree and the insert buffer in key order, tree first on equal keys
+        scanReturnedEntry = true;
+        if(deltaHasEntry && (!treeHasEntry || deltaKeys[deltaScanPos] < scanKeys[nextEntry])){
+                outRid = deltaRids[deltaScanPos];
+                scanLastKey = deltaKeys[deltaScanPos];
+                deltaScanPos++;
+                trace.returned();
+                return;
+        }
+        outRid = scanRids[nextEntry];
+        scanLastKey = scanKeys[nextEntry];
+        nextEntry++;
+        trace.returned();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNextSpan
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::scanNextSpan(LeafEntrySpan<int>& outSpan)
+{
+	TraceScope trace(traceRecorder, TRACE_SCAN_NEXT_SPAN);
+	if (scanExecuting == false)
+		throw ScanNotInitializedException();
+
+	// Once the previous span covered the rest of the leaf, this moves on
+	bool treeHasEntry = treeScanEntryAvailable();
+	bool deltaHasEntry = deltaScanPos < deltaScanEnd;
+	if (!treeHasEntry && !deltaHasEntry)
+		throw IndexScanCompletedException();
+
+	// A run of buffered entries coming before the next tree entry
+	if (deltaHasEntry && (!treeHasEntry || deltaKeys[deltaScanPos] < scanKeys[nextEntry])) {
+		int count = 0;
+		while (deltaScanPos + count < deltaScanEnd
+				&& (!treeHasEntry || deltaKeys[deltaScanPos + count] < scanKeys[nextEntry]))
+			count++;
+		outSpan.set(&deltaKeys[deltaScanPos], &deltaRids[deltaScanPos], count);
+		deltaScanPos += count;
+		scanReturnedEntry = true;
+		scanLastKey = outSpan.keys[count - 1];
+		trace.record.key = count;
+		trace.returned();
+		return;
+	}
+
+	// Hand out the remaining entries of the leaf within the high bound,
+	// up to the next buffered entry
+	int count = 0;
+	while (nextEntry + count < scanEntryCount && scanKeyInRange(scanKeys[nextEntry + count])
+			&& (!deltaHasEntry || scanKeys[nextEntry + count] <= deltaKeys[deltaScanPos]))
+		count++;
+
+	outSpan.set(scanKeys + nextEntry, scanRids + nextEntry, count);
+	nextEntry += count;
+	scanReturnedEntry = true;
+	scanLastKey = outSpan.keys[count - 1];
+	trace.record.key = count;
+	trace.returned();
+}
+
+
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::endScan
+// -----------------------------------------------------------------------------
+//
+const void BTreeIndex::endScan() 
+{
+	TraceScope trace(traceRecorder, TRACE_END_SCAN);
+	// If no scan is initialized 
+        if(!scanExecuting){
+                throw ScanNotInitializedException();
+        }
+        else{
+                // A scan is currently executing 
+                // Reset all the scan variables
+                //Unpin pinned pages
+                if(currentPageNum != 0)
+                        releasePage(currentPageNum);
+                if(openMode == READ_ONLY_MAPPED)
+                        madvise(mappedData, mappedSize, MADV_RANDOM);
+                scanExecuting = false;
+                nextEntry = -1;
+                currentPageNum = -1;
+                //lowOp = NULL; // how to deal with these operators ?
+                //highOp = NULL;
+                // the high and lower values must be reset
+
+                // entries held back during the scan may have filled the buffer
+                if (!deltaKeys.empty() && deltaKeys.size() >= deltaCapacity)
+                        flushInsertBuffer();
+        }
+        trace.returned();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::partitionScan
+// -----------------------------------------------------------------------------
+
+/*
+ * A leaf that may hold keys of the range, with the separator to its left
+ * in the tree (none for the leftmost leaf).
+*/
+struct ScanLeaf{
+	PageId pageNo;
+	bool hasLow;
+	int low;
+};
+
+const void BTreeIndex::partitionScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm,
+				   const int n,
+				   std::vector<IndexScanCursor*>& outCursors)
+{
+	outCursors.clear();
+	// the cursors run on threads of their own, which a trace cannot follow
+	if (traceRecorder != NULL)
+		throw TraceUnsupportedException();
+	if (lowOpParm != GT && lowOpParm != GTE)
+		throw BadOpcodesException();
+	if (highOpParm != LT && highOpParm != LTE)
+		throw BadOpcodesException();
+	if (attributeType != INTEGER){
+		std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
+		return;
+	}
+	int lowVal = *(int*)lowValParm;
+	int highVal = *(int*)highValParm;
+	if (lowVal > highVal)
+		throw BadScanrangeException();
+
+	// Leaves under the range, one level at a time. A key equal to a
+	// separator may sit in the child on either side of it, so both are kept.
+	std::vector<ScanLeaf> level(1);
+	level[0].pageNo = rootPageNum;
+	level[0].hasLow = false;
+	bool leafLevel = is_root_leaf;
+	while (!leafLevel) {
+		std::vector<ScanLeaf> children;
+		for (size_t i = 0; i < level.size(); i++) {
+			Page* page;
+			fetchPage(level[i].pageNo, page);
+			const NonLeafNodeInt* node = reinterpret_cast<const NonLeafNodeInt*>(page);
+			int first = nonLeafChildIndex(node, lowVal, false);
+			int last = nonLeafChildIndex(node, highVal, true);
+			for (int c = first; c <= last; c++) {
+				ScanLeaf child = level[i];
+				child.pageNo = node->pageNoArray[c];
+				if (c > 0) {
+					child.hasLow = true;
+					child.low = node->keyArray[c - 1];
+				}
+				children.push_back(child);
+			}
+			leafLevel = (node->level == 1);
+			releasePage(level[i].pageNo);
+		}
+		level.swap(children);
+	}
+
+	// Entries of the insert buffer within range
+	sortInsertBuffer();
+	size_t deltaLow = (lowOpParm == GT)
+		? std::upper_bound(deltaKeys.begin(), deltaKeys.end(), lowVal) - deltaKeys.begin()
+		: std::lower_bound(deltaKeys.begin(), deltaKeys.end(), lowVal) - deltaKeys.begin();
+	size_t deltaHigh = (highOpParm == LT)
+		? std::lower_bound(deltaKeys.begin(), deltaKeys.end(), highVal) - deltaKeys.begin()
+		: std::upper_bound(deltaKeys.begin(), deltaKeys.end(), highVal) - deltaKeys.begin();
+
+	// Runs of about equal numbers of leaves. A buffered entry goes to the
+	// cursor whose first leaf has the last separator not above its key.
+	size_t parts = std::min((size_t)std::max(n, 1), level.size());
+	size_t deltaPos = deltaLow;
+	for (size_t p = 0; p < parts; p++) {
+		size_t first = level.size() * p / parts;
+		size_t next = level.size() * (p + 1) / parts;
+		PageId stopPageNo = 0;
+		size_t deltaEnd = deltaHigh;
+		if (p + 1 < parts) {
+			stopPageNo = level[next].pageNo;
+			deltaEnd = std::lower_bound(deltaKeys.begin(), deltaKeys.end(), level[next].low) - deltaKeys.begin();
+			deltaEnd = std::min(std::max(deltaEnd, deltaPos), deltaHigh);
+		}
+		outCursors.push_back(new IndexScanCursor(this, level[first].pageNo, stopPageNo, deltaPos, deltaEnd,
+							lowVal, lowOpParm, highVal, highOpParm));
+		deltaPos = deltaEnd;
+	}
+}
+
+const void BTreeIndex::fetchCursorPage(PageId pageNo, Page*& page)
+{
+	if (openMode == READ_ONLY_MAPPED) {
+		fetchPage(pageNo, page);
+		return;
+	}
+	std::lock_guard<std::mutex> latch(cursorPageLatch);
+	fetchPage(pageNo, page);
+}
+
+const void BTreeIndex::releaseCursorPage(PageId pageNo)
+{
+	if (openMode == READ_ONLY_MAPPED) {
+		releasePage(pageNo);
+		return;
+	}
+	std::lock_guard<std::mutex> latch(cursorPageLatch);
+	releasePage(pageNo);
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor
+// -----------------------------------------------------------------------------
+
+IndexScanCursor::IndexScanCursor(BTreeIndex* index, PageId startPageNum, PageId stopPageNum, size_t deltaPos, size_t deltaEnd,
+		int lowValInt, Operator lowOp, int highValInt, Operator highOp)
+	: index(index), startPageNum(startPageNum), stopPageNum(stopPageNum), currentPageNum(0), currentPageData(NULL),
+	started(false), nextEntry(0), deltaPos(deltaPos), deltaEnd(deltaEnd),
+	lowValInt(lowValInt), highValInt(highValInt), lowOp(lowOp), highOp(highOp)
+{
+	entries.set(NULL, NULL, 0);
+	if (index->compressedLeaves) {
+		keyBuffer.resize(COMPRESSEDLEAFMAXSIZE);
+		ridBuffer.resize(COMPRESSEDLEAFMAXSIZE);
+	}
+}
+
+IndexScanCursor::~IndexScanCursor()
+{
+	if (currentPageNum != 0)
+		index->releaseCursorPage(currentPageNum);
+}
+
+const void IndexScanCursor::loadLeaf(PageId pageNo)
+{
+	currentPageNum = pageNo;
+	index->fetchCursorPage(pageNo, currentPageData);
+	index->readLeafEntries(currentPageData, keyBuffer, ridBuffer, entries);
+	nextEntry = 0;
+	// the next leaf of the run is read soon
+	PageId sibPageNo = index->leafRightSibling(currentPageData);
+	if (index->openMode == READ_ONLY_MAPPED && sibPageNo != 0 && sibPageNo != stopPageNum)
+		index->advisePage(sibPageNo, MADV_WILLNEED);
+}
+
+bool IndexScanCursor::treeEntryAvailable()
+{
+	if (!started) {
+		started = true;
+		loadLeaf(startPageNum);
+	}
+	while (currentPageNum != 0) {
+		while (nextEntry < entries.count) {
+			int key = entries.keys[nextEntry];
+			// the first leaf may start below the range
+			if (lowOp == GTE ? key < lowValInt : key <= lowValInt) {
+				nextEntry++;
+				continue;
+			}
+			if (highOp == LTE ? key <= highValInt : key < highValInt)
+				return true;
+			// past the range: nothing further along the chain either
+			index->releaseCursorPage(currentPageNum);
+			currentPageNum = 0;
+			return false;
+		}
+
+		PageId sibPageNo = index->leafRightSibling(currentPageData);
+		index->releaseCursorPage(currentPageNum);
+		currentPageNum = 0;
+		if (sibPageNo != 0 && sibPageNo != stopPageNum)
+			loadLeaf(sibPageNo);
+	}
+	return false;
+}
+
+const void IndexScanCursor::scanNext(RecordId& outRid)
+{
+	bool treeHasEntry = treeEntryAvailable();
+	bool deltaHasEntry = deltaPos < deltaEnd;
+	if (!treeHasEntry && !deltaHasEntry)
+		throw IndexScanCompletedException();
+
+	// on equal keys the tree's entries come first, as in scanNext
+	if (deltaHasEntry && (!treeHasEntry || index->deltaKeys[deltaPos] < entries.keys[nextEntry])) {
+		outRid = index->deltaRids[deltaPos];
+		deltaPos++;
+		return;
+	}
+	outRid = entries.rids[nextEntry];
+	nextEntry++;
 }
 
 }
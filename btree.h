@@ -11,11 +11,15 @@
 #include <string>
 #include "string.h"
 #include <sstream>
+#include <vector>
+#include <mutex>
 
 #include "types.h"
 #include "page.h"
 #include "file.h"
 #include "buffer.h"
+#include "bloom_filter.h"
+#include "index_trace.h"
 
 namespace badgerdb
 {
@@ -54,6 +58,73 @@ const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( int
 //                                                     level     extra pageNo                  key       pageNo
 const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
 
+/**
+ * @brief Number of INTEGER keys in a 64 byte cache line. Fence keys of a non-leaf search block are
+ * taken every NONLEAFSEARCHLINE keys, so each step of the search reads about one line.
+ */
+const  int NONLEAFSEARCHLINE = 16;
+
+/**
+ * @brief Number of fence keys over the keys of a non-leaf node (every NONLEAFSEARCHLINE-th key).
+ */
+const  int NONLEAFSEARCHMIDSIZE = ( INTARRAYNONLEAFSIZE + NONLEAFSEARCHLINE - 1 ) / NONLEAFSEARCHLINE;
+
+/**
+ * @brief Number of fence keys over the mid fences (every NONLEAFSEARCHLINE-th mid fence).
+ */
+const  int NONLEAFSEARCHTOPSIZE = ( NONLEAFSEARCHMIDSIZE + NONLEAFSEARCHLINE - 1 ) / NONLEAFSEARCHLINE;
+
+/**
+ * @brief Number of key slots a non-leaf search block takes from the end of keyArray:
+ * the key count, the top fences and the mid fences.
+ */
+const  int NONLEAFSEARCHBLOCKSIZE = 1 + NONLEAFSEARCHTOPSIZE + NONLEAFSEARCHMIDSIZE;
+
+/**
+ * @brief Smallest node capacity accepted through IndexOptions, so that a split leaves entries in both nodes.
+ */
+const  int MINNODECAPACITY = 4;
+
+/**
+ * @brief Ways of opening an index file. Passed to the BTreeIndex constructor through IndexOptions.
+ */
+enum IndexOpenMode
+{
+	READ_WRITE = 0,				/* pages go through the buffer manager */
+	READ_ONLY_MAPPED = 1	/* existing file mapped read-only, pages read in place, changes throw IndexReadOnlyException */
+};
+
+/**
+ * @brief Leaf page formats. Chosen when the index is created and stored in the meta page.
+ */
+enum LeafFormat
+{
+	PLAIN_LEAF = 0,			/* LeafNodeInt */
+	COMPRESSED_LEAF = 1	/* CompressedLeafNodeInt */
+};
+
+/**
+ * @brief Non-leaf page layouts. Chosen when the index is created and stored in the meta page.
+ */
+enum NonLeafLayout
+{
+	FLAT_NONLEAF = 0,					/* sorted keyArray searched by binary search */
+	SEARCH_BLOCK_NONLEAF = 1	/* the tail of keyArray holds fence keys searched a cache line at a time */
+};
+
+/**
+ * @brief Bytes available for the bit-packed entries of a compressed B+Tree leaf for INTEGER key.
+ */
+//                                                count, keyBase, bit widths   pageNoBase, sibling ptr
+const  int COMPRESSEDLEAFDATASIZE = Page::SIZE - 3 * sizeof( int ) - 2 * sizeof( PageId );
+
+/**
+ * @brief Maximum number of entries in a compressed B+Tree leaf for INTEGER key.
+ * An entry takes at most 32 + 32 + 16 bits (key, page number, slot number), so when a full leaf
+ * is split each half is guaranteed to fit in a page whatever the keys and RecordIds are.
+ */
+const  int COMPRESSEDLEAFMAXSIZE = 2 * ( ( COMPRESSEDLEAFDATASIZE - 32 ) / 10 );
+
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that 
  * add to or make changes to the leaf node pages of the tree. Is templated for the key member.
@@ -86,6 +157,49 @@ public:
 	}
 };
 
+/**
+ * @brief Structure to store the range of keys [low, high) that belongs to a node of the tree.
+ * A side whose flag is not set is unbounded. Is templated for the key members.
+*/
+template <class T>
+class KeyRange{
+public:
+	T low;
+	T high;
+	bool hasLow;
+	bool hasHigh;
+	void set( bool hl, T l, bool hh, T h )
+	{
+		hasLow = hl;
+		low = l;
+		hasHigh = hh;
+		high = h;
+	}
+	bool contains( T k ) const
+	{
+		return ( !hasLow || k >= low ) && ( !hasHigh || k < high );
+	}
+};
+
+/**
+ * @brief Read-only view over consecutive entries of a leaf: keys[i] and rids[i] belong to the same entry.
+ * Handed out by BTreeIndex::scanNextSpan(); the memory belongs to the pinned leaf page (or to the leaf decoded
+ * from it for compressed leaves, or to the insert buffer), so it is only valid until the next call on the index. Is templated for the key member.
+*/
+template <class T>
+class LeafEntrySpan{
+public:
+	const T* keys;
+	const RecordId* rids;
+	int count;
+	void set( const T* k, const RecordId* r, int c )
+	{
+		keys = k;
+		rids = r;
+		count = c;
+	}
+};
+
 /**
  * @brief Overloaded operator to compare the key values of two rid-key pairs
  * and if they are the same compares to see if the first pair has
@@ -128,6 +242,148 @@ struct IndexMetaInfo{
    * Page number of root page of the B+ Tree inside the file index file.
    */
 	PageId rootPageNo;
+
+  /**
+   * Format of the leaf pages.
+   */
+	LeafFormat leafFormat;
+
+  /**
+   * Layout of the non-leaf pages.
+   */
+	NonLeafLayout nonLeafLayout;
+
+  /**
+   * Number of entries a leaf holds, 0 for as many as fit in a page.
+   */
+	int leafCapacity;
+
+  /**
+   * Number of keys a non-leaf node holds, 0 for as many as fit in a page.
+   */
+	int nonLeafCapacity;
+
+  /**
+   * Changed every time the index file is created or opened read-write. The Bloom filter kept next to the
+   * index file is saved with it, and is out of date if it was saved with another one.
+   */
+	std::uint32_t bloomStamp;
+
+  /**
+   * First page of the free list (see FreeIndexPage), 0 if it is empty.
+   */
+	PageId freeListHead;
+};
+
+/**
+ * @brief Options for creating or opening an index. The creation options are recorded in the meta page,
+ * so opening an existing index file always uses the options it was created with.
+*/
+struct IndexOptions{
+  /**
+   * How to open the index file.
+   */
+	IndexOpenMode openMode;
+
+  /**
+   * Store leaves in the compressed format (CompressedLeafNodeInt).
+   */
+	bool compressLeaves;
+
+  /**
+   * Number of inserted entries held in memory before they are merged into the tree, must not be negative.
+   * 0 inserts every entry into the tree right away, except while a scan is executing. Not recorded in the meta page.
+   */
+	int insertBufferSize;
+
+  /**
+   * Number of keys to size a Bloom filter over the indexed keys for, 0 for no filter.
+   * The filter is kept in "<index name>.bloom" and is loaded whenever that file exists;
+   * for an existing index without one it is built from the leaves.
+   */
+	std::uint64_t bloomExpectedKeys;
+
+  /**
+   * False positive rate the Bloom filter is sized for once it holds bloomExpectedKeys keys.
+   * Together with bloomExpectedKeys this sets its memory footprint.
+   */
+	double bloomFalsePositiveRate;
+
+  /**
+   * Keep a search block of fence keys in every non-leaf node (NonLeafLayout SEARCH_BLOCK_NONLEAF),
+   * so finding a child touches a few cache lines instead of the ones a binary search over the
+   * whole keyArray lands on. Costs NONLEAFSEARCHBLOCKSIZE key slots per node.
+   */
+	bool nonLeafSearchBlock;
+
+  /**
+   * Number of entries per leaf, 0 for as many as fit in a page. Larger values are cut down to that.
+   * Fewer entries per leaf leave room for inserts between splits at the cost of more leaves per scan.
+   */
+	int leafNodeCapacity;
+
+  /**
+   * Number of keys per non-leaf node, 0 for as many as fit in a page. Larger values are cut down to that.
+   * Smaller inner nodes keep the hot part of each node, and the upper levels, within the CPU caches.
+   */
+	int nonLeafNodeCapacity;
+
+  /**
+   * Appended to the index name "<relation name>.<attribute byte offset>", so that several index
+   * files can exist over the same attribute (e.g. the shards of a ShardedBTreeIndex).
+   */
+	std::string indexNameSuffix;
+
+  /**
+   * Insert an entry for every record of the relation when creating the index file.
+   * If false a new index starts out empty.
+   */
+	bool buildFromRelation;
+
+  /**
+   * File to record every insertEntry, startScan, scanNext, scanNextSpan, endScan and lookupBatch call to,
+   * with its keys or bounds and how long it took, empty for no trace. The entries the index holds when
+   * it is opened are written first, so that a replay starts from the same content; the calls made while
+   * building a new index from the relation are not recorded. Only calls made from outside the index are
+   * recorded, not the ones it makes on itself. partitionScan() is refused while tracing. A trace can be
+   * rerun with the trace_replay driver. Each shard of a ShardedBTreeIndex writes its own trace, to this
+   * name with ".shard<number>" appended.
+   */
+	std::string traceFileName;
+
+	IndexOptions() : openMode( READ_WRITE ), compressLeaves( false ), insertBufferSize( 0 ),
+		bloomExpectedKeys( 0 ), bloomFalsePositiveRate( 0.01 ), nonLeafSearchBlock( false ),
+		leafNodeCapacity( 0 ), nonLeafNodeCapacity( 0 ), buildFromRelation( true ) {}
+};
+
+/**
+ * @brief Fragmentation of the leaf level of an index, reported by BTreeIndex::measureFragmentation().
+*/
+struct IndexFragmentation{
+  /**
+   * Number of leaves.
+   */
+	int leafCount;
+
+  /**
+   * Number of entries in the leaves, not counting the insert buffer.
+   */
+	std::uint64_t entryCount;
+
+  /**
+   * Entries per leaf over the leaf capacity, between 0 and 1.
+   */
+	double averageLeafFill;
+
+  /**
+   * Right sibling links that do not lead to the next page of the file, i.e. seeks in a range scan.
+   */
+	int discontiguousLinks;
+
+  /**
+   * Right sibling links that lead to an earlier page of the file.
+   */
+	int backwardLinks;
 };
 
 /*
@@ -180,12 +436,65 @@ struct LeafNodeInt{
 };
 
 
+/**
+ * @brief Structure for all leaf nodes of an index with compressed leaves when the key is of INTEGER type.
+ * Keys are stored frame-of-reference encoded (key - keyBase) and RecordIds as page number - pageNoBase
+ * and slot number, each bit-packed with the smallest width that holds its largest value.
+ * RecordIds of clustered or duplicate keys are close to each other, so far more entries fit than in a LeafNodeInt.
+*/
+struct CompressedLeafNodeInt{
+  /**
+   * Number of entries stored.
+   */
+	int count;
+
+  /**
+   * Smallest key of the leaf.
+   */
+	int keyBase;
+
+  /**
+   * Bits per packed key, page number and slot number. Last byte unused.
+   */
+	unsigned char bitWidths[ sizeof( int ) ];
+
+  /**
+   * Smallest page number of the RecordIds of the leaf.
+   */
+	PageId pageNoBase;
+
+  /**
+   * Page number of the leaf on the right side.
+   */
+	PageId rightSibPageNo;
+
+  /**
+   * Packed keys, followed by packed page numbers and packed slot numbers.
+   */
+	unsigned char data[ COMPRESSEDLEAFDATASIZE ];
+};
+
+/**
+ * @brief A page of the index file on the free list: no longer part of the tree and waiting to be reused.
+*/
+struct FreeIndexPage{
+  /**
+   * Page number of the next page on the free list, 0 for the last one.
+   */
+	PageId nextFreePageNo;
+};
+
+
+class IndexScanCursor;
+
 /**
  * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
  * relation. This index supports only one scan at a time.
 */
 class BTreeIndex {
 
+	friend class IndexScanCursor;
+
  private:
 
   /**
@@ -228,6 +537,46 @@ class BTreeIndex {
    */
 	int			nodeOccupancy;
 
+  /**
+   * True if non-leaf nodes carry a search block (NonLeafLayout SEARCH_BLOCK_NONLEAF).
+   */
+	bool		nonLeafSearchBlock;
+
+  /**
+   * How the index file was opened.
+   */
+	IndexOpenMode	openMode;
+
+  /**
+   * File descriptor of the index file when mapped read-only.
+   */
+	int			mappedFd;
+
+  /**
+   * Start of the read-only mapping of the index file.
+   */
+	char		*mappedData;
+
+  /**
+   * Size of the read-only mapping of the index file.
+   */
+	size_t	mappedSize;
+
+  /**
+   * True if leaves are stored as CompressedLeafNodeInt.
+   */
+	bool		compressedLeaves;
+
+  /**
+   * Scratch space to decode a compressed leaf into while inserting.
+   */
+	std::vector<int>	leafKeyBuffer;
+
+  /**
+   * Scratch space to decode the RecordIds of a compressed leaf into while inserting.
+   */
+	std::vector<RecordId>	leafRidBuffer;
+
 
 	// MEMBERS SPECIFIC TO SCANNING
 
@@ -251,6 +600,47 @@ class BTreeIndex {
    */
 	Page		*currentPageData;
 
+  /**
+   * Keys of the current page being scanned, in key order.
+   */
+	const int	*scanKeys;
+
+  /**
+   * RecordIds belonging to scanKeys.
+   */
+	const RecordId	*scanRids;
+
+  /**
+   * Number of entries in scanKeys/scanRids.
+   */
+	int			scanEntryCount;
+
+  /**
+   * Keys of the current leaf being scanned, when it had to be decoded.
+   */
+	std::vector<int>	scanKeyBuffer;
+
+  /**
+   * RecordIds of the current leaf being scanned, when it had to be decoded.
+   */
+	std::vector<RecordId>	scanRidBuffer;
+
+  /**
+   * Index of next entry of the insert buffer to be scanned.
+   */
+	size_t	deltaScanPos;
+
+  /**
+   * Index past the last entry of the insert buffer within the scan range.
+   */
+	size_t	deltaScanEnd;
+
+  /**
+   * True once the scan returned an entry, scanLastKey is then the key of the last one.
+   */
+	bool		scanReturnedEntry;
+	int			scanLastKey;
+
   /**
    * Low INTEGER value for scan.
    */
@@ -292,23 +682,355 @@ class BTreeIndex {
 	Operator	highOp;
 
  bool is_root_leaf; // if the root node is a LeafNode
-	
+
+  /**
+   * Set leafOccupancy and the decode buffers for the leaf format in compressedLeaves.
+   */
+	const void setLeafFormat();
+
+  /**
+   * Unpack the entries of a compressed leaf.
+   * @param leafPage				Page holding a CompressedLeafNodeInt
+   * @param keys						Receives the keys, room for COMPRESSEDLEAFMAXSIZE entries
+   * @param rids						Receives the RecordIds, room for COMPRESSEDLEAFMAXSIZE entries
+   * @return								Number of entries
+   */
+	int decodeLeaf(const Page* leafPage, int* keys, RecordId* rids) const;
+
+  /**
+   * Pack sorted entries into a compressed leaf. The page is left untouched if they do not fit.
+   * @param leafPage				Page to store the CompressedLeafNodeInt in
+   * @param keys						Keys in ascending order
+   * @param rids						RecordIds belonging to keys
+   * @param count						Number of entries
+   * @param rightSibPageNo	Page number of the right sibling of the leaf
+   * @return								False if the entries do not fit in the page.
+   */
+	bool encodeLeaf(Page* leafPage, const int* keys, const RecordId* rids, int count, PageId rightSibPageNo) const;
+
+  /**
+   * Get the entries of a leaf in either format. Plain leaves are not copied, compressed ones are decoded into the buffers.
+   * @param leafPage				Page holding the leaf
+   * @param keyBuffer				Space for decoded keys, COMPRESSEDLEAFMAXSIZE entries
+   * @param ridBuffer				Space for decoded RecordIds, COMPRESSEDLEAFMAXSIZE entries
+   * @param outEntries			Keys and RecordIds of the leaf
+   */
+	const void readLeafEntries(Page* leafPage, std::vector<int>& keyBuffer, std::vector<RecordId>& ridBuffer, LeafEntrySpan<int>& outEntries) const;
+
+  /**
+   * Page number of the right sibling of a leaf in either format, 0 for the last leaf.
+   */
+	PageId leafRightSibling(const Page* leafPage) const;
+
+  /**
+   * Insert the entry into a leaf in either format if there is room for it.
+   * @return	False, leaving the leaf untouched, if the leaf is full.
+   */
+	bool insertEntryInLeafPage(Page* leafPage, RIDKeyPair<int> entry);
+
+  /**
+   * Split a full leaf in either format and insert the entry in the proper half.
+   * @param leafPage		Page holding the full leaf, it keeps the lower half
+   * @param entry				Entry to insert
+   * @param newPage			Returns the page number and first key of the new leaf holding the upper half
+   */
+	const void splitLeafPage(Page* leafPage, RIDKeyPair<int> entry, PageKeyPair<int>& newPage);
+
+  /**
+   * Map the index file read-only into memory.
+   * @throws  FileNotFoundException If the file can not be opened or mapped.
+   */
+	const void mapIndexFile(const std::string& indexName);
+
+  /**
+   * Address of a page inside the read-only mapping.
+   */
+	Page* mappedPage(PageId pageNo) const;
+
+  /**
+   * Pass a madvise() hint for one page of the read-only mapping.
+   */
+	const void advisePage(PageId pageNo, int advice) const;
+
+  /**
+   * Get a page for reading. Pins it in the buffer pool, or points into the mapping in READ_ONLY_MAPPED mode.
+   * Every page got this way has to be handed back with releasePage().
+   */
+	const void fetchPage(PageId pageNo, Page*& page);
+
+  /**
+   * Release a page got from fetchPage().
+   */
+	const void releasePage(PageId pageNo);
+
+  /**
+   * Number of keys in a non-leaf node.
+   */
+	int nonLeafKeyCount(const NonLeafNodeInt* node) const;
+
+  /**
+   * Index in pageNoArray of the child of a non-leaf node to follow for a key: the number of keys
+   * below it, or below or equal to it when orEqual is set.
+   */
+	int nonLeafChildIndex(const NonLeafNodeInt* node, int key, bool orEqual) const;
+
+  /**
+   * Set nodeOccupancy for the non-leaf layout in nonLeafSearchBlock.
+   */
+	const void setNonLeafLayout();
+
+  /**
+   * Lower leafOccupancy and nodeOccupancy, set up for the page formats in use, to the given
+   * capacities. 0 keeps the page maximum.
+   */
+	const void setNodeCapacities(int leafCapacity, int nonLeafCapacity);
+
+  /**
+   * Rewrite the search block of a non-leaf node after its keys changed. Does nothing for the flat layout.
+   */
+	const void rebuildSearchBlock(NonLeafNodeInt* node);
+
+  /**
+   * Page number of the leftmost leaf of the tree.
+   */
+	PageId findLeftmostLeaf();
+
+  /**
+   * Find the leaf holding the first entry that satisfies the scan bounds, pin it and set up the scan members.
+   * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+   */
+	const void findStartRecordID();
+
+  /**
+   * Point scanKeys, scanRids and scanEntryCount at the entries of the leaf in currentPageData.
+   */
+	const void loadScanLeaf();
+
+  /**
+   * Move the scan to the right sibling of the current leaf, unpinning the current one.
+   * @return	False, leaving the current leaf pinned, if there is no right sibling.
+   */
+	bool advanceScanLeaf();
+
+  /**
+   * Set nextEntry to the next entry of the tree for the scan, moving to right siblings as needed.
+   * @return	False if the tree has no more entries within the scan range.
+   */
+	bool treeScanEntryAvailable();
+
+  /**
+   * True if key satisfies the low bound (lowOp, lowValInt) of the scan.
+   */
+	bool scanKeyAboveLow(int key) const;
+
+  /**
+   * True if key satisfies the high bound (highOp, highValInt) of the scan.
+   */
+	bool scanKeyInRange(int key) const;
+
+
+	// MEMBERS SPECIFIC TO INSERTING
+
+  /**
+   * Page number of the leaf the last insert went into, 0 if there is none to reuse.
+   */
+	PageId	lastLeafPageNum;
+
+  /**
+   * Range of keys that belongs to the leaf in lastLeafPageNum.
+   */
+	KeyRange<int>	lastLeafRange;
+
+  /**
+   * Bloom filter over every key inserted, NULL if the index has none.
+   */
+	BloomFilter	*bloomFilter;
+
+  /**
+   * Name of the file the Bloom filter is kept in.
+   */
+	std::string	bloomFileName;
+
+  /**
+   * IndexMetaInfo::bloomStamp of the index as opened, saved with the Bloom filter.
+   */
+	std::uint32_t	bloomStamp;
+
+  /**
+   * Load the Bloom filter of an existing index, or build it from the leaves if options ask for one.
+   * A stored filter is only used if it was saved with savedStamp.
+   */
+	const void openBloomFilter(const IndexOptions& options, std::uint32_t savedStamp);
+
+  /**
+   * Insert every key in the leaves into bloomFilter.
+   */
+	const void buildBloomFilter();
+
+  /**
+   * Keys of the insert buffer: the first deltaSortedCount in ascending order, the rest in insert order.
+   * Entries in the buffer are not in the tree yet.
+   */
+	std::vector<int>	deltaKeys;
+
+  /**
+   * RecordIds belonging to deltaKeys.
+   */
+	std::vector<RecordId>	deltaRids;
+
+  /**
+   * Number of entries the insert buffer holds before it is merged into the tree, 0 if there is no buffer.
+   */
+	size_t	deltaCapacity;
+
+  /**
+   * Number of entries at the start of the insert buffer that are in key order.
+   */
+	size_t	deltaSortedCount;
+
+  /**
+   * Append an entry to the insert buffer.
+   */
+	const void bufferEntry(RIDKeyPair<int> entry);
+
+  /**
+   * Sort the entries appended to the insert buffer since the last call in with the sorted ones.
+   * Entries with the same key stay in insert order.
+   */
+	const void sortInsertBuffer();
+
+  /**
+   * Insert an entry into the tree, bypassing the insert buffer.
+   */
+	const void insertEntryInTree(RIDKeyPair<int> entry);
+
+  /**
+   * Insert the entry straight into the leaf the last insert went into, without descending from the root.
+   * Only possible when the key falls within that leaf's key range and the leaf is not full.
+   * @param entry		Entry to insert
+   * @return				True if the entry was inserted, false if the normal descent has to be taken.
+   */
+	bool insertInLastLeaf(RIDKeyPair<int> entry);
+
+  /**
+   * Recorder of the calls on the index, NULL if they are not traced.
+   */
+	TraceRecorder*	traceRecorder;
+
+  /**
+   * Write a TRACE_LOAD record for every entry of the index just opened, in key order.
+   */
+	const void traceContent();
+
+  /**
+   * Serializes the buffer manager calls of the cursors handed out by partitionScan().
+   */
+	std::mutex	cursorPageLatch;
+
+  /**
+   * fetchPage() for a cursor running on another thread.
+   */
+	const void fetchCursorPage(PageId pageNo, Page*& page);
+
+  /**
+   * releasePage() for a cursor running on another thread.
+   */
+	const void releaseCursorPage(PageId pageNo);
+
+  /**
+   * True while a reorganization started by startReorganize() is in progress.
+   */
+	bool		reorganizing;
+
+  /**
+   * Number of entries the reorganization puts in every leaf.
+   */
+	int			reorgLeafFill;
+
+  /**
+   * Fraction of nodeOccupancy the reorganization fills the non-leaf nodes to.
+   */
+	double	reorgFillFactor;
+
+  /**
+   * Next leaf of the current tree to copy, 0 once all have been copied.
+   */
+	PageId	reorgSourcePageNum;
+
+  /**
+   * Entries copied from the current tree and not yet written to a new leaf.
+   */
+	std::vector<int>	reorgKeys;
+
+  /**
+   * RecordIds belonging to reorgKeys.
+   */
+	std::vector<RecordId>	reorgRids;
+
+  /**
+   * New leaves written so far, in key order, each with the separator to its left (unused for the first).
+   */
+	std::vector< PageKeyPair<int> >	reorgLeaves;
+
+  /**
+   * First page of the free list, as in IndexMetaInfo::freeListHead.
+   */
+	PageId	freeListHead;
+
+  /**
+   * Allocate a page for a new node: the first page of the free list if there is one, zeroed, else a new
+   * page at the end of the file.
+   */
+	const void allocIndexPage(PageId& pageNo, Page*& page);
+
+  /**
+   * Put pages that are no longer part of the tree on the free list.
+   */
+	const void freeIndexPages(std::vector<PageId>& pageNos);
+
+  /**
+   * Append the page numbers of the subtree under a node, the node included, to outPageNos.
+   */
+	const void collectTreePages(PageId pageNo, bool isLeaf, std::vector<PageId>& outPageNos);
+
+  /**
+   * Put an entry in the insert buffer while a scan runs over it. The entry is sorted in and the scan's
+   * position in the buffer moves with it.
+   */
+	const void bufferEntryInScan(RIDKeyPair<int> entry);
+
+  /**
+   * Write the first count entries of reorgKeys / reorgRids to a new leaf appended to the file,
+   * link it from the previous new leaf and drop the entries.
+   */
+	const void writeReorgLeaf(int count);
+
+  /**
+   * Build the non-leaf levels over reorgLeaves, bottom-up.
+   * @return	Page number of the new root
+   */
+	PageId buildReorgInnerLevels();
+
  public:
 
   /**
    * BTreeIndex Constructor. 
 	 * Check to see if the corresponding index file exists. If so, open the file.
 	 * If not, create it and insert entries for every tuple in the base relation using FileScan class.
+	 * In READ_ONLY_MAPPED mode the file has to exist; it is mapped and never goes through the buffer manager.
    *
    * @param relationName        Name of file.
    * @param outIndexName        Return the name of index file.
    * @param bufMgrIn						Buffer Manager Instance
    * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
    * @param attrType						Datatype of attribute over which index is built
-   * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
+   * @param options							Options for a new index file, ignored if the index file exists
+   * @throws  FileNotFoundException     If the index file is to be mapped read-only but does not exist.
+   * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters, or if options.insertBufferSize is negative.
    */
 	BTreeIndex(const std::string & relationName, std::string & outIndexName,
-						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const IndexOptions& options = IndexOptions());
 	
 
   /**
@@ -318,15 +1040,15 @@ class BTreeIndex {
 	 * Destructor should not throw any exceptions. All exceptions should be caught in here itself. 
 	 * */
 	~BTreeIndex();
-	const void lookupLeaf(PageId currPageNo, RIDKeyPair<int> entry, PageKeyPair<int>& insertedPage);
+	const void lookupLeaf(PageId currPageNo, RIDKeyPair<int> entry, PageKeyPair<int>& insertedPage, KeyRange<int> range);
 	const void insertLeafAtNode(RIDKeyPair<int> entry);
 	const void splitInsertLeafNode(PageId &leafPId, void *key, const RecordId rid);
 	const void splitLeafNode(LeafNodeInt* leafNode, RIDKeyPair<int> entry, PageKeyPair<int>& newInsertedPage);
-	const void splitNonLeafNode(NonLeafNodeInt* nonLeafNode, PageKeyPair<int> entry, PageKeyPair<int>& newInsertedPage);
+	const void splitNonLeafNode(NonLeafNodeInt* nonLeafNode, int childIdx, PageKeyPair<int> entry, PageKeyPair<int>& newInsertedPage);
 	const void makeNewRootNode(PageId pid, PageKeyPair<int> pageKey, bool setlevel);
 	const void insertNonLeafAtNode(PageId &nonleaf_pageid, int &level);
 	void insertEntryInLeaf(LeafNodeInt* leafNode, RIDKeyPair<int> entry);
-        void insertEntryInNonLeaf(NonLeafNodeInt* nonLeafNode, PageKeyPair<int> entry);
+        void insertEntryInNonLeaf(NonLeafNodeInt* nonLeafNode, int childIdx, PageKeyPair<int> entry);
 
 
   /**
@@ -335,11 +1057,88 @@ class BTreeIndex {
 	 * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
 	 * This may continue all the way upto the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
 	 * Make sure to unpin pages as soon as you can.
+	 * With an insert buffer the entry is only put in the buffer, which is merged into the tree once full.
+	 * While a scan is executing the entry is held in the buffer whatever its capacity, so that the leaf the
+	 * scan is on does not change under it; the scan returns it if it lies ahead of it within the range,
+	 * and the buffer is merged when the scan ends if it is full by then.
    * @param key			Key to insert, pointer to integer/double/char string
    * @param rid			Record ID of a record whose entry is getting inserted into the index.
+	 * @throws  IndexReadOnlyException If the index is opened READ_ONLY_MAPPED.
 	**/
 	const void insertEntry(const void* key, const RecordId rid);
 
+  /**
+	 * Merge the insert buffer into the tree. The entries are sorted, so every leaf is pinned once
+	 * for all the buffered entries that go into it instead of once per entry.
+	 * Ends the scan that is executing, if any. Does nothing while a reorganization is in progress.
+	**/
+	const void flushInsertBuffer();
+
+  /**
+	 * Merge the insert buffer into the tree and write every changed page to the index file.
+	 * Ends the scan that is executing, if any. Does nothing if the index is opened READ_ONLY_MAPPED.
+	**/
+	const void flush();
+
+  /**
+	 * Bytes of memory taken by the Bloom filter, 0 if the index has none.
+	**/
+	std::size_t bloomFilterMemory() const;
+
+  /**
+	 * Expected false positive rate of the Bloom filter with the keys inserted so far, 1 if the index has none.
+	**/
+	double bloomFilterFalsePositiveRate() const;
+
+  /**
+	 * Look up many keys at once, for instance the probe side of a join.
+	 * The probes are sorted and walk down the tree together, one level at a time, so every node on
+	 * their paths is read once and probes sharing a leaf share one pin of it. Within a node the binary
+	 * searches of the probes are interleaved with prefetches. Keys ruled out by the Bloom filter are skipped.
+   * @param keys				Keys to look up, pointer to an array of integers
+   * @param n						Number of keys
+   * @param outRids			Returns the RecordIds of all matches
+   * @param outOffsets	Returns n + 1 offsets: the matches of keys[i] are outRids[outOffsets[i]] up to outRids[outOffsets[i+1]]
+	**/
+	const void lookupBatch(const void* keys, const size_t n, std::vector<RecordId>& outRids, std::vector<size_t>& outOffsets);
+
+  /**
+	 * Walk the leaf level and report how full and how scattered the leaves are.
+   * @param outMetrics	Returns the metrics
+	**/
+	const void measureFragmentation(IndexFragmentation& outMetrics);
+
+  /**
+	 * Begin rewriting the index: the leaves are copied in key order into consecutive new pages at the end
+	 * of the file, filled to fillFactor of their capacity, and the non-leaf levels are rebuilt over them.
+	 * The work is done by reorganizeStep(). Until it is finished the current tree stays in use: scans and
+	 * lookups read it, and inserts are held in the insert buffer whatever its capacity and merged into the
+	 * new tree at the end. A running scan goes on and returns the entries inserted within its range ahead of it.
+	 * The pages of the old tree go on a free list in the end, and splits reuse them before growing the file.
+	 * If the index is closed before the reorganization is finished, the pages of the new tree go there instead.
+   * @param fillFactor	Fraction of the capacity of every new node to fill, in (0, 1]
+	 * @throws  IndexReadOnlyException If the index is opened READ_ONLY_MAPPED.
+	**/
+	const void startReorganize(double fillFactor);
+
+  /**
+	 * Copy up to maxLeaves more leaves into the new tree. Once all are copied, build the non-leaf levels,
+	 * write the new pages to disk and then switch IndexMetaInfo::rootPageNo to the new root, so the file
+	 * holds either the old tree or the complete new one. The switch waits for a running scan to end.
+	 * The pages of the old tree are then put on the free list.
+   * @param maxLeaves	Number of leaves of the current tree to copy in this step
+   * @return					True once the reorganization is complete (or none was started)
+	**/
+	bool reorganizeStep(int maxLeaves);
+
+  /**
+	 * Reorganize the whole index in one go, see startReorganize(). Ends the scan that is executing, if any.
+   * @param fillFactor	Fraction of the capacity of every new node to fill, in (0, 1]
+   * @param outBefore		Returns the fragmentation before
+   * @param outAfter		Returns the fragmentation after
+	**/
+	const void reorganize(double fillFactor, IndexFragmentation& outBefore, IndexFragmentation& outAfter);
+
   /**
 	 * Begin a filtered scan of the index.  For instance, if the method is called 
 	 * using ("a",GT,"d",LTE) then we should seek all entries with a value 
@@ -347,6 +1146,7 @@ class BTreeIndex {
 	 * If another scan is already executing, that needs to be ended here.
 	 * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
 	 * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
+	 * A point lookup (GTE and LTE on the same key) is checked against the Bloom filter first, if there is one.
    * @param lowVal	Low value of range, pointer to integer / double / char string
    * @param lowOp		Low operator (GT/GTE)
    * @param highVal	High value of range, pointer to integer / double / char string
@@ -368,14 +1168,150 @@ class BTreeIndex {
 	const void scanNext(RecordId& outRid);  // returned record id
 
 
+  /**
+	 * Fetch the next run of index entries that match the scan, without copying them.
+	 * The span points into the keyArray and ridArray of the leaf being scanned, which stays pinned
+	 * until the next call moves past it, so callers can work on the keys directly. Compressed leaves are
+	 * decoded once when the scan reaches them and the span points into the decoded entries. Spans never cross leaves.
+	 * Entries still in the insert buffer come as spans of their own, in key order with the tree's spans.
+   * @param outSpan	Keys and RecordIds of the next matching entries in key order
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	const void scanNextSpan(LeafEntrySpan<int>& outSpan);
+
+  /**
+	 * Split a range scan into independent cursors, for instance one per worker thread. The leaves holding
+	 * the range are found from the separators of the non-leaf nodes above them and cut into n runs of
+	 * consecutive leaves of about equal length; each cursor scans one run (and the entries of the insert
+	 * buffer between its separators), so no two cursors read the same leaf. Concatenated in order the
+	 * cursors yield the entries of startScan() with the same bounds.
+	 * Cursors can be used from different threads at once. Their buffer manager calls are serialized, in
+	 * READ_ONLY_MAPPED mode they read the mapping without any latch. The index must not be changed, and
+	 * in READ_WRITE mode not be used otherwise, while cursors are open.
+   * @param lowVal			Low value of range, pointer to integer
+   * @param lowOp				Low operator (GT/GTE)
+   * @param highVal			High value of range, pointer to integer
+   * @param highOp			High operator (LT/LTE)
+   * @param n						Number of cursors wanted; fewer are handed out if the range spans fewer leaves
+   * @param outCursors	Returns the cursors in key order, to be deleted by the caller
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+   * @throws  TraceUnsupportedException If the index is traced, see IndexOptions::traceFileName
+	**/
+	const void partitionScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+						const int n, std::vector<IndexScanCursor*>& outCursors);
+
+
   /**
 	 * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
+	 * Merge the insert buffer if the entries held back during the scan filled it.
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	**/
 	const void endScan();
 	
 };
 
+/**
+ * @brief Cursor over one part of a range scan, handed out by BTreeIndex::partitionScan().
+ * It walks its own run of leaves and keeps at most one of them pinned, released when it moves on,
+ * completes or is deleted.
+*/
+class IndexScanCursor {
+
+	friend class BTreeIndex;
+
+ private:
+
+  /**
+   * Index the cursor scans.
+   */
+	BTreeIndex*	index;
+
+  /**
+   * First leaf of the cursor's run.
+   */
+	PageId	startPageNum;
+
+  /**
+   * First leaf after the run, 0 if the run goes on to the end of the range.
+   */
+	PageId	stopPageNum;
+
+  /**
+   * Leaf being scanned, 0 before the first and after the last.
+   */
+	PageId	currentPageNum;
+
+  /**
+   * Page of the leaf being scanned.
+   */
+	Page*		currentPageData;
+
+  /**
+   * True once the first leaf was read.
+   */
+	bool		started;
+
+  /**
+   * Entries of the leaf being scanned.
+   */
+	LeafEntrySpan<int>	entries;
+
+  /**
+   * Index of the next entry in entries.
+   */
+	int			nextEntry;
+
+  /**
+   * Decode buffers for compressed leaves.
+   */
+	std::vector<int>	keyBuffer;
+	std::vector<RecordId>	ridBuffer;
+
+  /**
+   * Positions in the index's insert buffer of the cursor's next and past-the-last buffered entries.
+   */
+	size_t	deltaPos;
+	size_t	deltaEnd;
+
+  /**
+   * Scan bounds.
+   */
+	int			lowValInt;
+	int			highValInt;
+	Operator	lowOp;
+	Operator	highOp;
+
+	IndexScanCursor(BTreeIndex* index, PageId startPageNum, PageId stopPageNum, size_t deltaPos, size_t deltaEnd,
+						int lowValInt, Operator lowOp, int highValInt, Operator highOp);
+
+  /**
+   * Read a leaf of the run.
+   */
+	const void loadLeaf(PageId pageNo);
+
+  /**
+   * Move to the next entry of the run within the scan bounds, across leaves if needed.
+   * @return	False if the run has no more entries within the bounds
+   */
+	bool treeEntryAvailable();
+
+ public:
+
+  /**
+   * Release the leaf being scanned, if any.
+   */
+	~IndexScanCursor();
+
+  /**
+	 * Fetch the record id of the next index entry of the cursor's part of the scan, in key order.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws IndexScanCompletedException If no more records of the cursor's part are left to be scanned.
+	**/
+	const void scanNext(RecordId& outRid);
+};
+
 }
 
 
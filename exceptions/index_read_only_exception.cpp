@@ -0,0 +1,22 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "index_read_only_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+IndexReadOnlyException::IndexReadOnlyException()
+    : BadgerDbException("") {
+  std::stringstream ss;
+  ss << "Index is opened read-only and cannot be changed.";
+  message_.assign(ss.str());
+}
+
+}
@@ -0,0 +1,27 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when an index opened read-only is asked to change.
+ */
+class IndexReadOnlyException : public BadgerDbException {
+ public:
+  /**
+   * Constructs an index read-only exception.
+   */
+  explicit IndexReadOnlyException();
+};
+
+}
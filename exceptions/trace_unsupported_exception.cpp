@@ -0,0 +1,22 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "trace_unsupported_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+TraceUnsupportedException::TraceUnsupportedException()
+    : BadgerDbException("") {
+  std::stringstream ss;
+  ss << "Call cannot be recorded while the index is traced.";
+  message_.assign(ss.str());
+}
+
+}
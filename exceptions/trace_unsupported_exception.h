@@ -0,0 +1,27 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a call that cannot be recorded is made on a traced index.
+ */
+class TraceUnsupportedException : public BadgerDbException {
+ public:
+  /**
+   * Constructs a trace unsupported exception.
+   */
+  explicit TraceUnsupportedException();
+};
+
+}
@@ -0,0 +1,83 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <cstring>
+#include "index_trace.h"
+
+namespace badgerdb
+{
+
+TraceRecorder::TraceRecorder(const std::string& fileName)
+	: out(fileName.c_str(), std::ios::binary | std::ios::trunc), depth(0)
+{
+	TraceFileHeader header;
+	header.magic = TRACE_FILE_MAGIC;
+	header.version = TRACE_FILE_VERSION;
+	header.recordSize = sizeof(TraceRecord);
+	header.reserved = 0;
+	out.write((const char*)&header, sizeof(header));
+}
+
+const void TraceRecorder::write(const TraceRecord& record)
+{
+	out.write((const char*)&record, sizeof(record));
+}
+
+bool TraceRecorder::enterCall()
+{
+	return depth++ == 0;
+}
+
+const void TraceRecorder::leaveCall()
+{
+	depth--;
+}
+
+TraceScope::TraceScope(TraceRecorder* recorder, TraceOp op)
+	: recorder(recorder), topLevel(false), completed(false)
+{
+	if (recorder == NULL)
+		return;
+	topLevel = recorder->enterCall();
+	memset(&record, 0, sizeof(record));
+	record.op = (std::uint8_t)op;
+	start = std::chrono::steady_clock::now();
+}
+
+TraceScope::~TraceScope()
+{
+	if (recorder == NULL)
+		return;
+	recorder->leaveCall();
+	// a call made by the index itself is part of the one that made it
+	if (!topLevel)
+		return;
+	record.durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	record.threw = completed ? 0 : 1;
+	recorder->write(record);
+}
+
+const void TraceScope::returned()
+{
+	completed = true;
+}
+
+const void TraceScope::writeBatchKeys(const int* keys, const size_t n)
+{
+	if (recorder == NULL || !topLevel)
+		return;
+	TraceRecord keyRecord;
+	memset(&keyRecord, 0, sizeof(keyRecord));
+	keyRecord.op = TRACE_BATCH_KEY;
+	for (size_t i = 0; i < n; i++) {
+		keyRecord.key = keys[i];
+		recorder->write(keyRecord);
+	}
+	start = std::chrono::steady_clock::now();
+}
+
+}
@@ -0,0 +1,189 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+namespace badgerdb
+{
+
+/**
+ * @brief Operations recorded in an index trace.
+ */
+enum TraceOp
+{
+	TRACE_INSERT = 0,			/* insertEntry */
+	TRACE_START_SCAN = 1,	/* startScan */
+	TRACE_SCAN_NEXT = 2,	/* scanNext */
+	TRACE_END_SCAN = 3,		/* endScan */
+	TRACE_LOAD = 4,				/* entry in the index when tracing started, not a call */
+	TRACE_SCAN_NEXT_SPAN = 5,	/* scanNextSpan */
+	TRACE_LOOKUP_BATCH = 6,	/* lookupBatch */
+	TRACE_BATCH_KEY = 7		/* key of the lookupBatch recorded next, not a call */
+};
+
+/**
+ * @brief One operation of an index trace, as stored in the trace file (32 bytes).
+*/
+struct TraceRecord{
+  /**
+   * TraceOp of the call.
+   */
+	std::uint8_t op;
+
+  /**
+   * Low and high Operator of a startScan.
+   */
+	std::uint8_t lowOp;
+	std::uint8_t highOp;
+
+  /**
+   * 1 if the call ended with an exception (e.g. NoSuchKeyFoundException, IndexScanCompletedException), else 0.
+   */
+	std::uint8_t threw;
+
+  /**
+   * Key of an insertEntry, TRACE_LOAD or TRACE_BATCH_KEY record, low value of a startScan, number of
+   * entries a scanNextSpan handed out or of keys of a lookupBatch.
+   */
+	std::int32_t key;
+
+  /**
+   * High value of a startScan.
+   */
+	std::int32_t high;
+
+  /**
+   * RecordId of an insertEntry or TRACE_LOAD entry.
+   */
+	std::uint32_t pageNumber;
+	std::uint16_t slotNumber;
+
+	std::uint16_t reserved;
+	std::uint32_t reserved2;
+
+  /**
+   * Time the call took.
+   */
+	std::uint64_t durationNs;
+};
+
+/**
+ * @brief Header of a trace file.
+*/
+struct TraceFileHeader{
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint32_t recordSize;
+	std::uint32_t reserved;
+};
+
+/**
+ * @brief Tag at the start of a trace file.
+ */
+const std::uint32_t TRACE_FILE_MAGIC = 0x43525442;
+
+/**
+ * @brief Version of the trace file format.
+ */
+const std::uint32_t TRACE_FILE_VERSION = 3;
+
+/**
+ * @brief Writes the operations on an index to a trace file: a TraceFileHeader followed by TraceRecords,
+ * first a TRACE_LOAD record for every entry the index held when tracing started, then the calls. The keys
+ * of a lookupBatch come as TRACE_BATCH_KEY records right before its own record.
+*/
+class TraceRecorder {
+
+ private:
+
+  /**
+   * The trace file.
+   */
+	std::ofstream	out;
+
+  /**
+   * Number of traced calls in progress. Calls made from within another one are not recorded.
+   */
+	int	depth;
+
+ public:
+
+  /**
+   * Create (or overwrite) the trace file and write its header.
+   */
+	TraceRecorder(const std::string& fileName);
+
+  /**
+   * Append a record.
+   */
+	const void write(const TraceRecord& record);
+
+  /**
+   * Note the start of a traced call.
+   * @return	True if it is a top-level call, which gets recorded
+   */
+	bool enterCall();
+
+  /**
+   * Note the end of a traced call.
+   */
+	const void leaveCall();
+};
+
+/**
+ * @brief Times one call and writes its record when it goes out of scope, also when the call throws.
+ * Does nothing if there is no recorder, and records nothing for a call made from within another traced one.
+ * The call has to note every normal return with returned(); if it leaves without, it threw.
+*/
+class TraceScope {
+
+ private:
+
+	TraceRecorder*	recorder;
+
+  /**
+   * True if the call is not nested in another traced call.
+   */
+	bool	topLevel;
+
+  /**
+   * True once the call returned normally.
+   */
+	bool	completed;
+
+	std::chrono::steady_clock::time_point	start;
+
+ public:
+
+  /**
+   * Record of the call, filled in by the caller.
+   */
+	TraceRecord	record;
+
+	TraceScope(TraceRecorder* recorder, TraceOp op);
+
+	~TraceScope();
+
+  /**
+   * Note that the call is returning normally.
+   */
+	const void returned();
+
+  /**
+   * Write a TRACE_BATCH_KEY record for every key of a lookupBatch, ahead of the call's own record.
+   * The time this takes is not counted.
+   */
+	const void writeBatchKeys(const int* keys, const size_t n);
+};
+
+}
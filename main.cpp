@@ -0,0 +1,1492 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "btree.h"
+#include "sharded_index.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+#include "exceptions/index_read_only_exception.h"
+#include "exceptions/trace_unsupported_exception.h"
+
+#define checkPassFail(a, b) 																				\
+{																																		\
+	if((a) == (b))																											\
+		std::cout << "\nTest passed at line no:" << __LINE__ << "\n";		\
+	else																															\
+	{																																	\
+		std::cout << "\nTest FAILS at line no:" << __LINE__;						\
+		std::cout << "\nExpected:" << (b);															\
+		std::cout << "\nActual:" << (a);																\
+		std::cout << std::endl;																					\
+		exit(1);																												\
+	}																																	\
+}
+
+using namespace badgerdb;
+
+// -----------------------------------------------------------------------------
+// Globals
+// -----------------------------------------------------------------------------
+const std::string relationName = "relA";
+// the index is over the first field of the records, at byte offset 0
+const std::string indexName = relationName + ".0";
+BufMgr * bufMgr = new BufMgr(100);
+
+// The tests insert entries directly, without a relation behind them: the
+// entry for the n-th key inserted gets RecordId page number n + 1 (0 marks
+// an unused slot), so a RecordId a scan returns tells which key it was
+// inserted with. The slot number is made up from the page number, spread
+// over its whole range.
+std::vector<int> entryKeys;
+
+// -----------------------------------------------------------------------------
+// Forward declarations
+// -----------------------------------------------------------------------------
+
+RecordId entryRid(int key);
+SlotId entrySlot(PageId pageNo);
+bool entryMatches(int key, const RecordId& rid);
+template <class Index>
+void insertKeys(Index& index, const std::vector<int>& keys);
+template <class Index>
+void scanKeys(Index& index, int lowVal, Operator lowOp, int highVal, Operator highOp, std::vector<int>& outKeys);
+void spanScanKeys(BTreeIndex& index, int lowVal, Operator lowOp, int highVal, Operator highOp, std::vector<int>& outKeys);
+void expectedKeys(std::vector<int> keys, int lowVal, Operator lowOp, int highVal, Operator highOp, std::vector<int>& outKeys);
+template <class Index>
+void checkScans(Index& index, const std::vector<int>& keys);
+bool pointLookup(BTreeIndex& index, int key);
+void checkLookupBatch(BTreeIndex& index, const std::vector<int>& probeKeys);
+IndexOptions emptyIndexOptions();
+void copyFile(const std::string& from, const std::string& to);
+long fileSize(const std::string& name);
+void removeIndex(const std::string& name);
+void removeShardedIndex(const std::string& name);
+void readTrace(const std::string& name, std::vector<TraceRecord>& outRecords);
+void cursorKeys(IndexScanCursor* cursor, std::vector<int>& outKeys, bool& outRidsValid);
+void partitionKeys(BTreeIndex& index, int lowVal, Operator lowOp, int highVal, Operator highOp, int n, bool threaded, std::vector<int>& outKeys);
+
+void fastPathTest();
+void duplicateKeyTest();
+void reopenTest();
+void spanTest();
+void compressionTest();
+void mappedTest();
+void insertBufferTest();
+void bloomFilterTest();
+void lookupBatchTest();
+void searchBlockTest();
+void nodeCapacityTest();
+void reorganizeTest();
+void partitionScanTest();
+void shardedTest();
+void traceTest();
+
+int main(int argc, char **argv)
+{
+	std::srand(1);
+
+	fastPathTest();
+	duplicateKeyTest();
+	reopenTest();
+	spanTest();
+	compressionTest();
+	mappedTest();
+	insertBufferTest();
+	bloomFilterTest();
+	lookupBatchTest();
+	searchBlockTest();
+	nodeCapacityTest();
+	reorganizeTest();
+	partitionScanTest();
+	shardedTest();
+	traceTest();
+
+	delete bufMgr;
+	std::cout << "\nAll tests passed" << std::endl;
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+RecordId entryRid(int key)
+{
+	entryKeys.push_back(key);
+	RecordId rid;
+	rid.page_number = entryKeys.size();
+	rid.slot_number = entrySlot(rid.page_number);
+	return rid;
+}
+
+SlotId entrySlot(PageId pageNo)
+{
+	return (SlotId)(pageNo * 40503);
+}
+
+/*
+ * True if a RecordId is the one inserted with the key.
+*/
+bool entryMatches(int key, const RecordId& rid)
+{
+	return rid.page_number >= 1 && rid.page_number <= entryKeys.size()
+		&& entryKeys[rid.page_number - 1] == key && rid.slot_number == entrySlot(rid.page_number);
+}
+
+template <class Index>
+void insertKeys(Index& index, const std::vector<int>& keys)
+{
+	for (size_t i = 0; i < keys.size(); i++) {
+		int key = keys[i];
+		index.insertEntry(&key, entryRid(key));
+	}
+}
+
+/*
+ * Keys of the entries a scan returns, in the order it returns them.
+*/
+template <class Index>
+void scanKeys(Index& index, int lowVal, Operator lowOp, int highVal, Operator highOp, std::vector<int>& outKeys)
+{
+	outKeys.clear();
+	try
+	{
+		index.startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		return;
+	}
+
+	RecordId scanRid;
+	bool ridsValid = true;
+	while(1)
+	{
+		try
+		{
+			index.scanNext(scanRid);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+		if (!entryMatches(entryKeys[scanRid.page_number - 1], scanRid))
+			ridsValid = false;
+		outKeys.push_back(entryKeys[scanRid.page_number - 1]);
+	}
+	index.endScan();
+	checkPassFail(ridsValid, true)
+}
+
+/*
+ * Keys of the entries scanNextSpan hands out, in order. Every span has to
+ * hold at least one entry, with each key next to its own RecordId.
+*/
+void spanScanKeys(BTreeIndex& index, int lowVal, Operator lowOp, int highVal, Operator highOp, std::vector<int>& outKeys)
+{
+	outKeys.clear();
+	try
+	{
+		index.startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		return;
+	}
+
+	LeafEntrySpan<int> span;
+	bool spansValid = true;
+	while(1)
+	{
+		try
+		{
+			index.scanNextSpan(span);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+		if (span.count <= 0)
+			spansValid = false;
+		for (int i = 0; i < span.count; i++) {
+			if (!entryMatches(span.keys[i], span.rids[i]))
+				spansValid = false;
+			outKeys.push_back(span.keys[i]);
+		}
+	}
+	index.endScan();
+	checkPassFail(spansValid, true)
+}
+
+/*
+ * Keys a scan over an index holding keys has to return, in order.
+*/
+void expectedKeys(std::vector<int> keys, int lowVal, Operator lowOp, int highVal, Operator highOp, std::vector<int>& outKeys)
+{
+	std::sort(keys.begin(), keys.end());
+	outKeys.clear();
+	for (size_t i = 0; i < keys.size(); i++) {
+		if ((lowOp == GT ? keys[i] > lowVal : keys[i] >= lowVal) && (highOp == LT ? keys[i] < highVal : keys[i] <= highVal))
+			outKeys.push_back(keys[i]);
+	}
+}
+
+/*
+ * Check a full scan and a few range and point scans of an index holding keys.
+*/
+template <class Index>
+void checkScans(Index& index, const std::vector<int>& keys)
+{
+	std::vector<int> scanned;
+	std::vector<int> expected;
+
+	int minKey = *std::min_element(keys.begin(), keys.end());
+	int maxKey = *std::max_element(keys.begin(), keys.end());
+	scanKeys(index, minKey, GTE, maxKey, LTE, scanned);
+	expectedKeys(keys, minKey, GTE, maxKey, LTE, expected);
+	checkPassFail(scanned.size(), keys.size())
+	checkPassFail(scanned == expected, true)
+
+	for (int i = 0; i < 5; i++) {
+		int low = minKey + std::rand() % (maxKey - minKey + 1);
+		int high = low + std::rand() % (maxKey - low + 1);
+		scanKeys(index, low, GT, high, LTE, scanned);
+		expectedKeys(keys, low, GT, high, LTE, expected);
+		checkPassFail(scanned == expected, true)
+
+		scanKeys(index, low, GTE, low, LTE, scanned);
+		expectedKeys(keys, low, GTE, low, LTE, expected);
+		checkPassFail(scanned.size(), expected.size())
+	}
+}
+
+/*
+ * True if a point scan finds the key.
+*/
+bool pointLookup(BTreeIndex& index, int key)
+{
+	std::vector<int> scanned;
+	scanKeys(index, key, GTE, key, LTE, scanned);
+	return !scanned.empty();
+}
+
+/*
+ * lookupBatch has to find, for every probe, the entries a point scan finds.
+*/
+void checkLookupBatch(BTreeIndex& index, const std::vector<int>& probeKeys)
+{
+	std::vector<RecordId> rids;
+	std::vector<size_t> offsets;
+	index.lookupBatch(&probeKeys[0], probeKeys.size(), rids, offsets);
+	checkPassFail(offsets.size(), probeKeys.size() + 1)
+
+	size_t mismatches = 0;
+	std::vector<int> scanned;
+	for (size_t i = 0; i < probeKeys.size(); i++) {
+		scanKeys(index, probeKeys[i], GTE, probeKeys[i], LTE, scanned);
+		if (offsets[i + 1] - offsets[i] != scanned.size())
+			mismatches++;
+		for (size_t j = offsets[i]; j < offsets[i + 1]; j++) {
+			if (!entryMatches(probeKeys[i], rids[j]))
+				mismatches++;
+		}
+	}
+	checkPassFail(mismatches, 0)
+}
+
+/*
+ * Options for an index that starts out empty instead of being built from the relation.
+*/
+IndexOptions emptyIndexOptions()
+{
+	IndexOptions options;
+	options.buildFromRelation = false;
+	return options;
+}
+
+void copyFile(const std::string& from, const std::string& to)
+{
+	std::ifstream in(from.c_str(), std::ios::binary);
+	std::ofstream out(to.c_str(), std::ios::binary | std::ios::trunc);
+	out << in.rdbuf();
+}
+
+long fileSize(const std::string& name)
+{
+	std::ifstream in(name.c_str(), std::ios::binary | std::ios::ate);
+	return (long)in.tellg();
+}
+
+void removeIndex(const std::string& name)
+{
+	try {
+		File::remove(name);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	std::remove((name + ".bloom").c_str());
+}
+
+/*
+ * Keys of the entries a cursor returns, in the order it returns them.
+*/
+void cursorKeys(IndexScanCursor* cursor, std::vector<int>& outKeys, bool& outRidsValid)
+{
+	RecordId scanRid;
+	while(1)
+	{
+		try
+		{
+			cursor->scanNext(scanRid);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+		if (!entryMatches(entryKeys[scanRid.page_number - 1], scanRid))
+			outRidsValid = false;
+		outKeys.push_back(entryKeys[scanRid.page_number - 1]);
+	}
+}
+
+/*
+ * Keys of the entries the cursors of partitionScan return, cursor after
+ * cursor, each cursor run on its own thread if threaded.
+*/
+void partitionKeys(BTreeIndex& index, int lowVal, Operator lowOp, int highVal, Operator highOp, int n, bool threaded, std::vector<int>& outKeys)
+{
+	std::vector<IndexScanCursor*> cursors;
+	index.partitionScan(&lowVal, lowOp, &highVal, highOp, n, cursors);
+	checkPassFail(cursors.size() <= (size_t)n, true)
+
+	std::vector< std::vector<int> > keys(cursors.size());
+	std::vector<char> ridsValid(cursors.size(), true);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < cursors.size(); i++) {
+		if (threaded) {
+			threads.push_back(std::thread([&cursors, &keys, &ridsValid, i]() {
+				bool valid = true;
+				cursorKeys(cursors[i], keys[i], valid);
+				ridsValid[i] = valid;
+			}));
+		} else {
+			bool valid = true;
+			cursorKeys(cursors[i], keys[i], valid);
+			ridsValid[i] = valid;
+		}
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	outKeys.clear();
+	for (size_t i = 0; i < cursors.size(); i++) {
+		outKeys.insert(outKeys.end(), keys[i].begin(), keys[i].end());
+		delete cursors[i];
+	}
+	checkPassFail(std::count(ridsValid.begin(), ridsValid.end(), false), 0)
+}
+
+/*
+ * Records of a trace file, after checking its header.
+*/
+void readTrace(const std::string& name, std::vector<TraceRecord>& outRecords)
+{
+	std::ifstream in(name.c_str(), std::ios::binary);
+	TraceFileHeader header;
+	in.read((char*)&header, sizeof(header));
+	checkPassFail((bool)in, true)
+	checkPassFail(header.magic, TRACE_FILE_MAGIC)
+	checkPassFail(header.version, TRACE_FILE_VERSION)
+	checkPassFail(header.recordSize, sizeof(TraceRecord))
+
+	outRecords.clear();
+	TraceRecord record;
+	while (in.read((char*)&record, sizeof(record)))
+		outRecords.push_back(record);
+}
+
+/*
+ * Remove the directory and the shard files of a sharded index.
+*/
+void removeShardedIndex(const std::string& name)
+{
+	for (int id = 0; id < 1000; id++) {
+		std::ostringstream shardName;
+		shardName << name << ".shard" << id;
+		if (File::exists(shardName.str()))
+			removeIndex(shardName.str());
+	}
+	std::remove((name + ".shards").c_str());
+}
+
+// -----------------------------------------------------------------------------
+// Tests
+// -----------------------------------------------------------------------------
+
+/*
+ * Ascending, descending and random inserts, which take the last-leaf fast
+ * path to different degrees, all have to end up in key order.
+*/
+void fastPathTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "fastPathTest" << std::endl;
+
+	for (int order = 0; order < 3; order++) {
+		std::vector<int> keys;
+		for (int i = 0; i < 20000; i++)
+			keys.push_back(i);
+		if (order == 1)
+			std::reverse(keys.begin(), keys.end());
+		else if (order == 2)
+			std::random_shuffle(keys.begin(), keys.end());
+
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+			insertKeys(index, keys);
+			checkScans(index, keys);
+		}
+		removeIndex(indexName);
+	}
+}
+
+/*
+ * Many entries over few keys: leaf splits leave equal keys on both sides of
+ * the key they push up, which must not mix up the order of the leaves.
+*/
+void duplicateKeyTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "duplicateKeyTest" << std::endl;
+
+	std::vector<int> keys;
+	for (int i = 0; i < 30000; i++)
+		keys.push_back(std::rand() % 51);
+
+	removeIndex(indexName);
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+		insertKeys(index, keys);
+		checkScans(index, keys);
+	}
+	removeIndex(indexName);
+
+	// with small nodes the runs of equal keys span many leaves and inner nodes
+	std::vector<int> smallKeys;
+	for (int i = 0; i < 5000; i++)
+		smallKeys.push_back(std::rand() % 51);
+	IndexOptions options = emptyIndexOptions();
+	options.leafNodeCapacity = 8;
+	options.nonLeafNodeCapacity = 8;
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+		insertKeys(index, smallKeys);
+		checkScans(index, smallKeys);
+	}
+	removeIndex(indexName);
+}
+
+/*
+ * Close an index, open it again and go on inserting into it.
+*/
+void reopenTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "reopenTest" << std::endl;
+
+	std::vector<int> keys;
+	for (int i = 0; i < 10000; i++)
+		keys.push_back(std::rand() % 100000);
+
+	removeIndex(indexName);
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+		insertKeys(index, keys);
+	}
+	for (int session = 0; session < 2; session++) {
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+		checkScans(index, keys);
+
+		std::vector<int> moreKeys;
+		for (int i = 0; i < 5000; i++)
+			moreKeys.push_back(std::rand() % 100000);
+		insertKeys(index, moreKeys);
+		keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+		checkScans(index, keys);
+		// writes every page back, which fails if one is left pinned
+		index.flush();
+	}
+	removeIndex(indexName);
+}
+
+/*
+ * Spans over plain and compressed leaves and over the insert buffer have to
+ * hand out the same entries as scanNext.
+*/
+void spanTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "spanTest" << std::endl;
+
+	for (int variant = 0; variant < 3; variant++) {
+		IndexOptions options = emptyIndexOptions();
+		options.compressLeaves = (variant == 1);
+		options.insertBufferSize = (variant == 2) ? 1500 : 0;
+
+		std::vector<int> keys;
+		for (int i = 0; i < 10000; i++)
+			keys.push_back(std::rand() % 20000);
+
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+
+			std::vector<int> scanned;
+			std::vector<int> expected;
+			spanScanKeys(index, 0, GTE, 20000, LT, scanned);
+			checkPassFail(scanned.size(), keys.size())
+			expectedKeys(keys, 0, GTE, 20000, LT, expected);
+			checkPassFail(scanned == expected, true)
+
+			spanScanKeys(index, 5000, GT, 6000, LTE, scanned);
+			expectedKeys(keys, 5000, GT, 6000, LTE, expected);
+			checkPassFail(scanned == expected, true)
+		}
+		removeIndex(indexName);
+	}
+}
+
+/*
+ * Compressed leaves have to give back the keys and RecordIds they were
+ * given, also after the index is closed and opened again, whatever the
+ * spread of the keys, and hold more entries than plain leaves.
+*/
+void compressionTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "compressionTest" << std::endl;
+
+	// keys over the whole int range, with runs of equal and close keys
+	std::vector<int> keys;
+	for (int i = 0; i < 10000; i++)
+		keys.push_back(std::rand() - std::rand());
+	for (int i = 0; i < 10000; i++)
+		keys.push_back(std::rand() % 1000);
+
+	IndexOptions options = emptyIndexOptions();
+	options.compressLeaves = true;
+	removeIndex(indexName);
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+		insertKeys(index, keys);
+	}
+	{
+		// the leaf format comes from the meta page
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+		std::vector<int> scanned;
+		std::vector<int> expected;
+		scanKeys(index, INT_MIN, GTE, INT_MAX, LTE, scanned);
+		checkPassFail(scanned.size(), keys.size())
+		expectedKeys(keys, INT_MIN, GTE, INT_MAX, LTE, expected);
+		checkPassFail(scanned == expected, true)
+
+		spanScanKeys(index, -1, GT, 500, LTE, scanned);
+		expectedKeys(keys, -1, GT, 500, LTE, expected);
+		checkPassFail(scanned == expected, true)
+	}
+	removeIndex(indexName);
+
+	// ascending keys of a clustered relation
+	std::vector<int> clusteredKeys;
+	for (int i = 0; i < 20000; i++)
+		clusteredKeys.push_back(i);
+	int leafCount[2];
+	for (int compressed = 0; compressed < 2; compressed++) {
+		options.compressLeaves = (compressed == 1);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, clusteredKeys);
+			checkScans(index, clusteredKeys);
+			IndexFragmentation fragmentation;
+			index.measureFragmentation(fragmentation);
+			checkPassFail(fragmentation.entryCount, clusteredKeys.size())
+			leafCount[compressed] = fragmentation.leafCount;
+		}
+		removeIndex(indexName);
+	}
+	checkPassFail(leafCount[1] < leafCount[0], true)
+}
+
+/*
+ * An index opened READ_ONLY_MAPPED reads the same entries as through the
+ * buffer manager and refuses inserts. A file too short to hold the meta
+ * page is not mapped.
+*/
+void mappedTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "mappedTest" << std::endl;
+
+	std::vector<int> keys;
+	for (int i = 0; i < 20000; i++)
+		keys.push_back(std::rand() % 30000);
+
+	for (int compressed = 0; compressed < 2; compressed++) {
+		IndexOptions options = emptyIndexOptions();
+		options.compressLeaves = (compressed == 1);
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+		}
+
+		IndexOptions mappedOptions = emptyIndexOptions();
+		mappedOptions.openMode = READ_ONLY_MAPPED;
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, mappedOptions);
+		checkScans(index, keys);
+
+		std::vector<int> scanned;
+		std::vector<int> expected;
+		spanScanKeys(index, 1000, GTE, 2000, LT, scanned);
+		expectedKeys(keys, 1000, GTE, 2000, LT, expected);
+		checkPassFail(scanned == expected, true)
+
+		bool refused = false;
+		try
+		{
+			int key = 5;
+			index.insertEntry(&key, entryRid(key));
+		}
+		catch(IndexReadOnlyException e)
+		{
+			refused = true;
+		}
+		checkPassFail(refused, true)
+	}
+	removeIndex(indexName);
+
+	{
+		std::ofstream shortFile(indexName.c_str(), std::ios::binary);
+		shortFile << "not an index";
+	}
+	bool mapped = true;
+	try
+	{
+		IndexOptions mappedOptions = emptyIndexOptions();
+		mappedOptions.openMode = READ_ONLY_MAPPED;
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, mappedOptions);
+	}
+	catch(FileNotFoundException e)
+	{
+		mapped = false;
+	}
+	checkPassFail(mapped, false)
+	removeIndex(indexName);
+}
+
+/*
+ * Entries inserted while a scan runs are held back from the tree the scan
+ * is reading; the scan returns the ones ahead of it within its range, in
+ * key order, and all of them are in the index once it ended.
+*/
+void insertBufferTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "insertBufferTest" << std::endl;
+
+	for (int variant = 0; variant < 4; variant++) {
+		IndexOptions options = emptyIndexOptions();
+		options.insertBufferSize = (variant & 1) ? 700 : 0;
+		options.compressLeaves = (variant & 2) != 0;
+
+		// even keys before the scan, odd ones during it
+		std::vector<int> keys;
+		for (int i = 0; i < 5000; i++)
+			keys.push_back(2 * i);
+		std::random_shuffle(keys.begin(), keys.end());
+
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+
+			int low = 2000;
+			int high = 8000;
+			index.startScan(&low, GTE, &high, LT);
+			std::vector<int> scanned;
+			RecordId scanRid;
+			for (int i = 0; i < 1000; i++) {
+				index.scanNext(scanRid);
+				scanned.push_back(entryKeys[scanRid.page_number - 1]);
+			}
+			int lastKey = scanned.back();
+
+			// behind the scan, ahead of it and out of its range, enough
+			// of them to split leaves if they went into the tree
+			std::vector<int> moreKeys;
+			for (int i = 0; i < 2000; i++)
+				moreKeys.push_back(2 * (std::rand() % 5000) + 1);
+			insertKeys(index, moreKeys);
+
+			bool ridsValid = true;
+			while(1)
+			{
+				try
+				{
+					index.scanNext(scanRid);
+				}
+				catch(IndexScanCompletedException e)
+				{
+					break;
+				}
+				if (!entryMatches(entryKeys[scanRid.page_number - 1], scanRid))
+					ridsValid = false;
+				scanned.push_back(entryKeys[scanRid.page_number - 1]);
+			}
+			index.endScan();
+			checkPassFail(ridsValid, true)
+
+			std::vector<int> expected;
+			expectedKeys(keys, low, GTE, high, LT, expected);
+			std::vector<int> aheadKeys;
+			expectedKeys(moreKeys, lastKey, GT, high, LT, aheadKeys);
+			expected.insert(expected.end(), aheadKeys.begin(), aheadKeys.end());
+			std::sort(expected.begin(), expected.end());
+			checkPassFail(scanned.size(), expected.size())
+			checkPassFail(scanned == expected, true)
+
+			keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+			checkScans(index, keys);
+		}
+		removeIndex(indexName);
+	}
+}
+
+/*
+ * The Bloom filter must never rule out a key the index holds: not after
+ * it is saved and loaded again, and not when the file next to the index
+ * is older than the index, in which case it has to be rebuilt.
+*/
+void bloomFilterTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "bloomFilterTest" << std::endl;
+
+	IndexOptions options = emptyIndexOptions();
+	options.bloomExpectedKeys = 20000;
+	options.bloomFalsePositiveRate = 0.01;
+
+	// even keys first, odd ones in a later session
+	std::vector<int> evenKeys;
+	std::vector<int> oddKeys;
+	for (int i = 0; i < 5000; i++) {
+		evenKeys.push_back(2 * i);
+		oddKeys.push_back(2 * i + 1);
+	}
+	const std::string bloomName = indexName + ".bloom";
+	const std::string oldBloomName = indexName + ".bloom.old";
+
+	removeIndex(indexName);
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+		checkPassFail(index.bloomFilterMemory() > 0, true)
+		insertKeys(index, evenKeys);
+		checkPassFail(pointLookup(index, 1000), true)
+		checkPassFail(pointLookup(index, 1001), false)
+		checkPassFail(pointLookup(index, -5), false)
+	}
+	checkPassFail(File::exists(bloomName), true)
+	copyFile(bloomName, oldBloomName);
+
+	{
+		// the filter file is loaded even when none is asked for
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+		checkPassFail(index.bloomFilterMemory() > 0, true)
+		checkPassFail(pointLookup(index, 4242), true)
+		insertKeys(index, oddKeys);
+		checkPassFail(pointLookup(index, 4243), true)
+	}
+
+	// put back the filter from before the odd keys were inserted
+	copyFile(oldBloomName, bloomName);
+	std::remove(oldBloomName.c_str());
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+		checkPassFail(index.bloomFilterMemory() > 0, true)
+		int missed = 0;
+		for (int i = 0; i < 5000; i += 7) {
+			if (!pointLookup(index, oddKeys[i]) || !pointLookup(index, evenKeys[i]))
+				missed++;
+		}
+		checkPassFail(missed, 0)
+	}
+	removeIndex(indexName);
+}
+
+/*
+ * lookupBatch against point scans: on unique keys, on runs of equal keys
+ * across many leaves, with the search block, compressed leaves, entries in
+ * the insert buffer and a mapped index, for present and absent keys and
+ * probes given more than once.
+*/
+void lookupBatchTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "lookupBatchTest" << std::endl;
+
+	for (int variant = 0; variant < 5; variant++) {
+		IndexOptions options = emptyIndexOptions();
+		options.nonLeafSearchBlock = (variant == 1);
+		options.compressLeaves = (variant == 2);
+		options.insertBufferSize = (variant == 3) ? 2500 : 0;
+		if (variant == 4) {
+			options.leafNodeCapacity = 8;
+			options.nonLeafNodeCapacity = 8;
+		}
+
+		std::vector<int> keys;
+		for (int i = 0; i < 30000; i++)
+			keys.push_back(std::rand() % 51);
+		for (int i = 0; i < 10000; i++)
+			keys.push_back(100 + 2 * (std::rand() % 20000));
+
+		std::vector<int> probeKeys;
+		for (int i = -2; i < 60; i++)
+			probeKeys.push_back(i);
+		for (int i = 0; i < 500; i++)
+			probeKeys.push_back(std::rand() % 40200);
+		probeKeys.push_back(7);
+		probeKeys.push_back(45);
+
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+			checkLookupBatch(index, probeKeys);
+		}
+		if (variant == 0) {
+			IndexOptions mappedOptions = emptyIndexOptions();
+			mappedOptions.openMode = READ_ONLY_MAPPED;
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, mappedOptions);
+			checkLookupBatch(index, probeKeys);
+		}
+		removeIndex(indexName);
+	}
+}
+
+/*
+ * Non-leaf nodes with a search block, full ones over many small leaves and
+ * small ones with few keys per fence, have to route inserts, scans and
+ * lookups like flat ones, also after the index is opened again without
+ * asking for the layout.
+*/
+void searchBlockTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "searchBlockTest" << std::endl;
+
+	for (int variant = 0; variant < 2; variant++) {
+		IndexOptions options = emptyIndexOptions();
+		options.nonLeafSearchBlock = true;
+		options.leafNodeCapacity = 16;
+		options.nonLeafNodeCapacity = (variant == 0) ? 0 : 40;
+
+		std::vector<int> keys;
+		for (int i = 0; i < 60000; i++)
+			keys.push_back(std::rand() % 200000);
+		for (int i = 0; i < 5000; i++)
+			keys.push_back(77777);
+
+		std::vector<int> probeKeys;
+		for (int i = 0; i < 300; i++)
+			probeKeys.push_back(std::rand() % 200000);
+		probeKeys.push_back(77777);
+
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+			checkScans(index, keys);
+			checkLookupBatch(index, probeKeys);
+		}
+		{
+			// the layout comes from the meta page
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+			checkScans(index, keys);
+
+			std::vector<int> moreKeys;
+			for (int i = 0; i < 10000; i++)
+				moreKeys.push_back(std::rand() % 200000);
+			insertKeys(index, moreKeys);
+			keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+			checkScans(index, keys);
+			checkLookupBatch(index, probeKeys);
+		}
+		removeIndex(indexName);
+	}
+}
+
+/*
+ * Node capacities set the number of entries per leaf, are kept in the meta
+ * page, and are cut to what fits a page or to the minimum.
+*/
+void nodeCapacityTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "nodeCapacityTest" << std::endl;
+
+	std::vector<int> keys;
+	for (int i = 0; i < 8000; i++)
+		keys.push_back(i);
+
+	IndexOptions options = emptyIndexOptions();
+	options.leafNodeCapacity = 8;
+	options.nonLeafNodeCapacity = 8;
+	removeIndex(indexName);
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+		insertKeys(index, keys);
+		checkScans(index, keys);
+		IndexFragmentation fragmentation;
+		index.measureFragmentation(fragmentation);
+		checkPassFail(fragmentation.leafCount >= 1000, true)
+		checkPassFail(fragmentation.averageLeafFill <= 1.0, true)
+	}
+	{
+		// opened without capacities, the ones of the meta page hold
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+		std::vector<int> moreKeys;
+		for (int i = 8000; i < 16000; i++)
+			moreKeys.push_back(i);
+		insertKeys(index, moreKeys);
+		keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+		checkScans(index, keys);
+		IndexFragmentation fragmentation;
+		index.measureFragmentation(fragmentation);
+		checkPassFail(fragmentation.leafCount >= 2000, true)
+		checkPassFail(fragmentation.averageLeafFill <= 1.0, true)
+	}
+	removeIndex(indexName);
+
+	// too small and too large capacities are cut
+	int leafCount[2];
+	for (int variant = 0; variant < 2; variant++) {
+		options.leafNodeCapacity = (variant == 0) ? 1 : 1000000;
+		options.nonLeafNodeCapacity = (variant == 0) ? 1 : 1000000;
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+			checkScans(index, keys);
+			IndexFragmentation fragmentation;
+			index.measureFragmentation(fragmentation);
+			checkPassFail(fragmentation.averageLeafFill <= 1.0, true)
+			leafCount[variant] = fragmentation.leafCount;
+		}
+		removeIndex(indexName);
+	}
+	checkPassFail(leafCount[0] <= (int)keys.size() / 2, true)
+	checkPassFail(leafCount[1] <= (int)keys.size() / INTARRAYLEAFSIZE * 2 + 1, true)
+}
+
+/*
+ * A reorganization packs the leaves into consecutive pages without losing
+ * entries, also with inserts and a scan going on while it is done step by
+ * step. The pages it leaves behind are reused by later splits, also those
+ * of a reorganization dropped when the index is closed.
+*/
+void reorganizeTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "reorganizeTest" << std::endl;
+
+	for (int compressed = 0; compressed < 2; compressed++) {
+		IndexOptions options = emptyIndexOptions();
+		options.compressLeaves = (compressed == 1);
+
+		std::vector<int> keys;
+		for (int i = 0; i < 30000; i++)
+			keys.push_back(std::rand() % 100000);
+		std::vector<int> probeKeys(keys.begin(), keys.begin() + 200);
+
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+
+			IndexFragmentation before;
+			IndexFragmentation after;
+			index.reorganize(0.9, before, after);
+			checkPassFail(before.entryCount, keys.size())
+			checkPassFail(after.entryCount, keys.size())
+			checkPassFail(after.discontiguousLinks, 0)
+			checkPassFail(after.backwardLinks, 0)
+			checkPassFail(after.leafCount < before.leafCount, true)
+			checkScans(index, keys);
+			checkLookupBatch(index, probeKeys);
+		}
+		{
+			// the freed pages of the old tree take the splits of more inserts
+			long size = fileSize(indexName);
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+			checkScans(index, keys);
+			std::vector<int> moreKeys;
+			for (int i = 0; i < 3000; i++)
+				moreKeys.push_back(std::rand() % 100000);
+			insertKeys(index, moreKeys);
+			keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+			checkScans(index, keys);
+			index.flush();
+			checkPassFail(fileSize(indexName), size)
+		}
+		{
+			// step by step, with inserts and a scan in between
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+			index.startReorganize(1.0);
+			checkPassFail(index.reorganizeStep(5), false)
+
+			int low = 20000;
+			int high = 60000;
+			index.startScan(&low, GTE, &high, LTE);
+			RecordId scanRid;
+			std::vector<int> scanned;
+			for (int i = 0; i < 100; i++) {
+				index.scanNext(scanRid);
+				scanned.push_back(entryKeys[scanRid.page_number - 1]);
+			}
+			std::vector<int> moreKeys;
+			for (int i = 0; i < 2000; i++)
+				moreKeys.push_back(std::rand() % 100000);
+			insertKeys(index, moreKeys);
+			// the new tree can not take over while the scan is open
+			while (!index.reorganizeStep(5) && scanned.size() < 1000) {
+				index.scanNext(scanRid);
+				scanned.push_back(entryKeys[scanRid.page_number - 1]);
+			}
+			checkPassFail(index.reorganizeStep(1000000), false)
+			index.endScan();
+			checkPassFail(std::is_sorted(scanned.begin(), scanned.end()), true)
+			checkPassFail(index.reorganizeStep(1), true)
+
+			keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+			checkScans(index, keys);
+			IndexFragmentation fragmentation;
+			index.measureFragmentation(fragmentation);
+			checkPassFail(fragmentation.entryCount, keys.size())
+		}
+		removeIndex(indexName);
+
+		// dropped half way when the index is closed, on an index with no
+		// free pages yet
+		keys.resize(30000);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+		}
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+			index.startReorganize(1.0);
+			checkPassFail(index.reorganizeStep(20), false)
+		}
+		{
+			long size = fileSize(indexName);
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+			checkScans(index, keys);
+			std::vector<int> moreKeys;
+			for (int i = 0; i < 1500; i++)
+				moreKeys.push_back(100000 + i);
+			insertKeys(index, moreKeys);
+			keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+			checkScans(index, keys);
+			index.flush();
+			checkPassFail(fileSize(indexName), size)
+		}
+		removeIndex(indexName);
+	}
+}
+
+/*
+ * The cursors of a partitioned scan together return what one scan does,
+ * run one after the other or all at once, with entries in the insert
+ * buffer and over a mapped index.
+*/
+void partitionScanTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "partitionScanTest" << std::endl;
+
+	std::vector<int> keys;
+	for (int i = 0; i < 30000; i++)
+		keys.push_back(std::rand() % 60000);
+	const int partCounts[] = {1, 3, 8, 1000};
+
+	for (int compressed = 0; compressed < 2; compressed++) {
+		IndexOptions options = emptyIndexOptions();
+		options.compressLeaves = (compressed == 1);
+		options.insertBufferSize = 500;
+		removeIndex(indexName);
+		{
+			std::string outIndexName;
+			BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+			insertKeys(index, keys);
+
+			for (int c = 0; c < 4; c++) {
+				std::vector<int> parted;
+				std::vector<int> expected;
+				partitionKeys(index, 0, GTE, 60000, LT, partCounts[c], false, parted);
+				expectedKeys(keys, 0, GTE, 60000, LT, expected);
+				checkPassFail(parted == expected, true)
+
+				int low = std::rand() % 60000;
+				int high = low + std::rand() % (60000 - low);
+				partitionKeys(index, low, GT, high, LTE, partCounts[c], c % 2 == 1, parted);
+				expectedKeys(keys, low, GT, high, LTE, expected);
+				checkPassFail(parted == expected, true)
+			}
+		}
+
+		IndexOptions mappedOptions = emptyIndexOptions();
+		mappedOptions.openMode = READ_ONLY_MAPPED;
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, mappedOptions);
+		for (int c = 0; c < 4; c++) {
+			std::vector<int> parted;
+			std::vector<int> expected;
+			int low = std::rand() % 60000;
+			int high = low + std::rand() % (60000 - low);
+			partitionKeys(index, low, GTE, high, LT, partCounts[c], true, parted);
+			expectedKeys(keys, low, GTE, high, LT, expected);
+			checkPassFail(parted == expected, true)
+		}
+	}
+	removeIndex(indexName);
+}
+
+/*
+ * Shards split as they grow, from several inserting threads, during a
+ * scan and after being opened again; the scans see every key once, in
+ * order, across the shards.
+*/
+void shardedTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "shardedTest" << std::endl;
+
+	const int threadCount = 4;
+	std::vector<int> keys;
+	for (int i = 0; i < 20000; i++)
+		keys.push_back(std::rand() % 50000);
+	// entryRid is not safe to call from the threads
+	std::vector<RecordId> rids;
+	for (size_t i = 0; i < keys.size(); i++)
+		rids.push_back(entryRid(keys[i]));
+
+	removeShardedIndex(indexName);
+	size_t shardCount;
+	{
+		std::string outIndexName;
+		ShardedBTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, 4, 50, 2000, emptyIndexOptions());
+		checkPassFail(outIndexName, indexName)
+		checkPassFail(index.shardCount(), 1)
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < threadCount; t++) {
+			threads.push_back(std::thread([&index, &keys, &rids, t]() {
+				for (size_t i = t; i < keys.size(); i += threadCount)
+					index.insertEntry(&keys[i], rids[i]);
+			}));
+		}
+		for (int t = 0; t < threadCount; t++)
+			threads[t].join();
+		checkPassFail(index.shardCount() >= keys.size() / 2000, true)
+		checkScans(index, keys);
+
+		// splits are put off until the scan ended
+		int low = 10000;
+		int high = 40000;
+		index.startScan(&low, GTE, &high, LT);
+		RecordId scanRid;
+		std::vector<int> scanned;
+		for (int i = 0; i < 100; i++) {
+			index.scanNext(scanRid);
+			scanned.push_back(entryKeys[scanRid.page_number - 1]);
+		}
+		size_t scanShardCount = index.shardCount();
+		std::vector<int> moreKeys;
+		for (size_t i = 0; i < keys.size(); i++)
+			moreKeys.push_back(std::rand() % 50000);
+		insertKeys(index, moreKeys);
+		checkPassFail(index.shardCount(), scanShardCount)
+		while (1) {
+			try
+			{
+				index.scanNext(scanRid);
+			}
+			catch(IndexScanCompletedException e)
+			{
+				break;
+			}
+			scanned.push_back(entryKeys[scanRid.page_number - 1]);
+		}
+		index.endScan();
+		checkPassFail(std::is_sorted(scanned.begin(), scanned.end()), true)
+		checkPassFail(index.shardCount() > scanShardCount, true)
+
+		keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+		checkScans(index, keys);
+		shardCount = index.shardCount();
+	}
+	{
+		// the shards of an opened index are counted before they split again
+		std::string outIndexName;
+		ShardedBTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, 4, 50, 2000, emptyIndexOptions());
+		checkPassFail(index.shardCount(), shardCount)
+		checkScans(index, keys);
+
+		std::vector<int> moreKeys;
+		for (int i = 0; i < 1000 * (int)shardCount; i++)
+			moreKeys.push_back(std::rand() % 50000);
+		insertKeys(index, moreKeys);
+		checkPassFail(index.shardCount() > shardCount, true)
+		keys.insert(keys.end(), moreKeys.begin(), moreKeys.end());
+		checkScans(index, keys);
+		shardCount = index.shardCount();
+	}
+	{
+		IndexOptions mappedOptions = emptyIndexOptions();
+		mappedOptions.openMode = READ_ONLY_MAPPED;
+		std::string outIndexName;
+		ShardedBTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, 4, 50, 2000, mappedOptions);
+		checkPassFail(index.shardCount(), shardCount)
+		checkScans(index, keys);
+
+		bool refused = false;
+		try
+		{
+			int key = 5;
+			index.insertEntry(&key, entryRid(key));
+		}
+		catch(IndexReadOnlyException e)
+		{
+			refused = true;
+		}
+		checkPassFail(refused, true)
+	}
+	removeShardedIndex(indexName);
+
+	// few distinct keys: the copies of a key all go to one side of a split
+	keys.clear();
+	for (int i = 0; i < 5000; i++)
+		keys.push_back(std::rand() % 100);
+	{
+		std::string outIndexName;
+		ShardedBTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, 4, 50, 300, emptyIndexOptions());
+		insertKeys(index, keys);
+		checkPassFail(index.shardCount() > 1, true)
+
+		size_t mismatches = 0;
+		std::vector<int> scanned;
+		std::vector<int> expected;
+		for (int key = 0; key < 100; key++) {
+			scanKeys(index, key, GTE, key, LTE, scanned);
+			expectedKeys(keys, key, GTE, key, LTE, expected);
+			if (scanned != expected)
+				mismatches++;
+		}
+		checkPassFail(mismatches, 0)
+	}
+	removeShardedIndex(indexName);
+}
+
+/*
+ * A trace holds the content the index was opened with and then one record
+ * per call made from outside, in order, with the ones that threw marked.
+ * partitionScan is refused while tracing, and every shard of a sharded
+ * index traces to a file of its own.
+*/
+void traceTest()
+{
+	std::cout << "--------------------" << std::endl;
+	std::cout << "traceTest" << std::endl;
+
+	const std::string traceName = "relA.trace";
+	std::vector<int> keys;
+	for (int i = 0; i < 3000; i++)
+		keys.push_back(std::rand() % 10000);
+
+	removeIndex(indexName);
+	{
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, emptyIndexOptions());
+		insertKeys(index, keys);
+	}
+
+	std::vector<int> probeKeys(keys.begin(), keys.begin() + 10);
+	std::vector<int> expectedOps;
+	{
+		IndexOptions options = emptyIndexOptions();
+		options.traceFileName = traceName;
+		options.insertBufferSize = 100;
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+
+		std::vector<int> moreKeys(1, 10000);
+		insertKeys(index, moreKeys);
+		expectedOps.push_back(TRACE_INSERT);
+
+		int low = 100;
+		int high = 200;
+		index.startScan(&low, GTE, &high, LT);
+		RecordId scanRid;
+		index.scanNext(scanRid);
+		LeafEntrySpan<int> span;
+		index.scanNextSpan(span);
+		index.endScan();
+		expectedOps.push_back(TRACE_START_SCAN);
+		expectedOps.push_back(TRACE_SCAN_NEXT);
+		expectedOps.push_back(TRACE_SCAN_NEXT_SPAN);
+		expectedOps.push_back(TRACE_END_SCAN);
+
+		bool threw = false;
+		try
+		{
+			index.scanNext(scanRid);
+		}
+		catch(ScanNotInitializedException e)
+		{
+			threw = true;
+		}
+		checkPassFail(threw, true)
+		expectedOps.push_back(TRACE_SCAN_NEXT);
+
+		std::vector<RecordId> rids;
+		std::vector<size_t> offsets;
+		index.lookupBatch(&probeKeys[0], probeKeys.size(), rids, offsets);
+		for (size_t i = 0; i < probeKeys.size(); i++)
+			expectedOps.push_back(TRACE_BATCH_KEY);
+		expectedOps.push_back(TRACE_LOOKUP_BATCH);
+
+		bool refused = false;
+		std::vector<IndexScanCursor*> cursors;
+		try
+		{
+			index.partitionScan(&low, GTE, &high, LT, 4, cursors);
+		}
+		catch(TraceUnsupportedException e)
+		{
+			refused = true;
+		}
+		checkPassFail(refused, true)
+		checkPassFail(cursors.size(), 0)
+	}
+
+	std::vector<TraceRecord> records;
+	readTrace(traceName, records);
+	checkPassFail(records.size(), keys.size() + expectedOps.size())
+	size_t loaded = 0;
+	while (loaded < records.size() && records[loaded].op == TRACE_LOAD)
+		loaded++;
+	checkPassFail(loaded, keys.size())
+
+	std::vector<int> ops;
+	for (size_t i = loaded; i < records.size(); i++)
+		ops.push_back(records[i].op);
+	checkPassFail(ops == expectedOps, true)
+
+	const TraceRecord* calls = &records[loaded];
+	checkPassFail(calls[0].key, 10000)
+	checkPassFail(calls[0].threw, 0)
+	checkPassFail(calls[1].key, 100)
+	checkPassFail(calls[1].high, 200)
+	checkPassFail(calls[1].threw, 0)
+	checkPassFail(calls[3].key > 0, true)
+	checkPassFail(calls[5].threw, 1)
+	for (size_t i = 0; i < probeKeys.size(); i++)
+		checkPassFail(calls[6 + i].key, probeKeys[i])
+	checkPassFail(calls[6 + probeKeys.size()].key, (int)probeKeys.size())
+	checkPassFail(calls[6 + probeKeys.size()].threw, 0)
+	std::remove(traceName.c_str());
+	removeIndex(indexName);
+
+	removeShardedIndex(indexName);
+	size_t shardCount;
+	{
+		IndexOptions options = emptyIndexOptions();
+		options.traceFileName = traceName;
+		std::string outIndexName;
+		ShardedBTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, 4, 50, 500, options);
+		insertKeys(index, keys);
+		checkPassFail(index.shardCount() > 1, true)
+		shardCount = index.shardCount();
+	}
+	checkPassFail(std::ifstream(traceName.c_str()).good(), false)
+	std::vector<TraceRecord> shardRecords;
+	size_t traceFiles = 0;
+	size_t inserts = 0;
+	for (int id = 0; id < 1000; id++) {
+		std::ostringstream shardTraceName;
+		shardTraceName << traceName << ".shard" << id;
+		if (!std::ifstream(shardTraceName.str().c_str()).good())
+			continue;
+		traceFiles++;
+		readTrace(shardTraceName.str(), shardRecords);
+		for (size_t i = 0; i < shardRecords.size(); i++) {
+			if (shardRecords[i].op == TRACE_INSERT)
+				inserts++;
+		}
+		std::remove(shardTraceName.str().c_str());
+	}
+	// a shard that was split away leaves its trace behind
+	checkPassFail(traceFiles > shardCount, true)
+	// every key is inserted into a shard, and again into the half it goes
+	// to when that is split
+	checkPassFail(inserts >= keys.size(), true)
+	std::remove(traceName.c_str());
+	removeShardedIndex(indexName);
+}
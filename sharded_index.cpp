@@ -0,0 +1,599 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <utility>
+#include "sharded_index.h"
+#include "filescan.h"
+#include "exceptions/bad_opcodes_exception.h"
+#include "exceptions/bad_scanrange_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/end_of_file_exception.h"
+#include "exceptions/index_read_only_exception.h"
+
+namespace badgerdb
+{
+
+// -----------------------------------------------------------------------------
+// ShardedBTreeIndex::ShardedBTreeIndex -- Constructor
+// -----------------------------------------------------------------------------
+
+ShardedBTreeIndex::ShardedBTreeIndex(const std::string & relationName,
+		std::string & outIndexName,
+		BufMgr *bufMgrIn,
+		const int attrByteOffset,
+		const Datatype attrType,
+		const int shardCount,
+		const std::uint32_t shardBufferFrames,
+		const std::uint64_t splitEntries,
+		const IndexOptions& options)
+{
+	std::ostringstream idxStr;
+	idxStr << relationName << '.' << attrByteOffset << options.indexNameSuffix;
+	outIndexName = idxStr.str();
+
+	this->relationName = relationName;
+	this->attrByteOffset = attrByteOffset;
+	attributeType = attrType;
+	directoryFileName = outIndexName + ".shards";
+	this->shardBufferFrames = shardBufferFrames;
+	// a read-only index does not grow
+	this->splitEntries = (options.openMode == READ_ONLY_MAPPED) ? 0 : splitEntries;
+	nextShardId = 0;
+	splitsInProgress = 0;
+	scanExecuting = false;
+	splitPending = false;
+	shardScanExecuting = false;
+
+	// the shards are filled here, not by each reading the whole relation
+	shardOptions = options;
+	shardOptions.buildFromRelation = false;
+
+	if (File::exists(directoryFileName)) {
+		loadDirectory();
+	} else {
+		if (options.openMode == READ_ONLY_MAPPED)
+			throw FileNotFoundException(directoryFileName);
+		createShards(bufMgrIn, shardCount);
+		// the shards are on disk before the directory names them
+		for (size_t i = 0; i < shards.size(); i++)
+			shards[i]->index->flush();
+		saveDirectory();
+	}
+	std::cout << "Sharded index opened with " << shards.size() << " shards" << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+// ShardedBTreeIndex::~ShardedBTreeIndex -- destructor
+// -----------------------------------------------------------------------------
+
+ShardedBTreeIndex::~ShardedBTreeIndex()
+{
+	if (scanExecuting)
+		endScan();
+	bool saved = false;
+	if (shardOptions.openMode != READ_ONLY_MAPPED) {
+		for (size_t i = 0; i < shards.size(); i++)
+			shards[i]->index->flush();
+		saved = saveDirectory();
+	}
+	for (size_t i = 0; i < shards.size(); i++)
+		closeShard(shards[i]);
+	if (saved)
+		removeRetiredShards();
+}
+
+// -----------------------------------------------------------------------------
+// Shards
+// -----------------------------------------------------------------------------
+
+std::string ShardedBTreeIndex::shardIndexName(int id) const
+{
+	std::ostringstream name;
+	name << relationName << '.' << attrByteOffset << shardOptions.indexNameSuffix << ".shard" << id;
+	return name.str();
+}
+
+IndexShard* ShardedBTreeIndex::openShard(int id, bool hasLow, int low, bool create)
+{
+	IndexShard* shard = new IndexShard;
+	shard->id = id;
+	shard->hasLow = hasLow;
+	shard->low = low;
+	shard->scanOpen = false;
+	shard->splitting = false;
+	// a mapped index reads its pages straight from the mapping
+	shard->bufMgr = NULL;
+	if (shardOptions.openMode != READ_ONLY_MAPPED)
+		shard->bufMgr = new BufMgr(shardBufferFrames);
+
+	IndexOptions options = shardOptions;
+	std::ostringstream suffix;
+	suffix << ".shard" << id;
+	options.indexNameSuffix += suffix.str();
+	// each shard's index records its own calls
+	if (!options.traceFileName.empty())
+		options.traceFileName += suffix.str();
+	std::string shardIndexName;
+	{
+		std::lock_guard<std::mutex> files(fileLatch);
+		// a file of this number that no directory named, from a split or a
+		// creation cut short
+		if (create && File::exists(this->shardIndexName(id)))
+			File::remove(this->shardIndexName(id));
+		shard->index = new BTreeIndex(relationName, shardIndexName, shard->bufMgr, attrByteOffset, attributeType, options);
+	}
+
+	// an opened shard is counted when it first needs to be
+	shard->entryCount = 0;
+	shard->entryCountKnown = create;
+	shard->splitThreshold = splitEntries;
+	return shard;
+}
+
+/*
+ * Walks the shard's leaves once. Called before the first insert into an
+ * opened shard, so neither its insert buffer nor its held entries hold
+ * anything yet.
+*/
+const void ShardedBTreeIndex::countShardEntries(IndexShard* shard)
+{
+	IndexFragmentation metrics;
+	shard->index->measureFragmentation(metrics);
+	shard->entryCount = metrics.entryCount;
+	shard->entryCountKnown = true;
+}
+
+const void ShardedBTreeIndex::closeShard(IndexShard* shard)
+{
+	// the index flushes its file through the buffer manager, so it goes first
+	{
+		std::lock_guard<std::mutex> files(fileLatch);
+		delete shard->index;
+	}
+	delete shard->bufMgr;
+	delete shard;
+}
+
+/*
+ * The last shard whose low is not above the key; the first shard has no
+ * low and takes every key below the second.
+*/
+size_t ShardedBTreeIndex::findShard(int key) const
+{
+	size_t lo = 1;
+	size_t hi = shards.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (shards[mid]->low <= key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+/*
+ * Directory file: the next shard number, then one line per shard in key
+ * order with its number, whether it has a low and the low. Written to a
+ * temporary file and renamed over the old one, so a crash leaves one or
+ * the other.
+*/
+bool ShardedBTreeIndex::saveDirectory()
+{
+	std::string tempFileName = directoryFileName + ".tmp";
+	std::ofstream out(tempFileName.c_str(), std::ios::trunc);
+	out << nextShardId << '\n';
+	for (size_t i = 0; i < shards.size(); i++)
+		out << shards[i]->id << ' ' << shards[i]->hasLow << ' ' << shards[i]->low << '\n';
+	out.close();
+	if (!out) {
+		std::cout << "Could not write shard directory " << tempFileName << std::endl;
+		std::remove(tempFileName.c_str());
+		return false;
+	}
+	if (std::rename(tempFileName.c_str(), directoryFileName.c_str()) != 0) {
+		std::cout << "Could not replace shard directory " << directoryFileName << std::endl;
+		std::remove(tempFileName.c_str());
+		return false;
+	}
+	return true;
+}
+
+const void ShardedBTreeIndex::removeRetiredShards()
+{
+	std::lock_guard<std::mutex> files(fileLatch);
+	for (size_t i = 0; i < retiredShardIds.size(); i++) {
+		std::string indexName = shardIndexName(retiredShardIds[i]);
+		if (File::exists(indexName))
+			File::remove(indexName);
+		std::remove((indexName + ".bloom").c_str());
+	}
+	retiredShardIds.clear();
+}
+
+const void ShardedBTreeIndex::loadDirectory()
+{
+	std::ifstream in(directoryFileName.c_str());
+	in >> nextShardId;
+	int id;
+	bool hasLow;
+	int low;
+	while (in >> id >> hasLow >> low)
+		shards.push_back(openShard(id, hasLow, low, false));
+}
+
+/*
+ * Boundaries at the quantiles of the keys in the relation, so that the
+ * shards start out about equally full. Duplicate quantiles collapse, so a
+ * relation with few distinct keys gets fewer shards.
+*/
+const void ShardedBTreeIndex::createShards(BufMgr* bufMgrIn, int shardCount)
+{
+	std::vector< std::pair<int, RecordId> > entries;
+	if (attributeType == INTEGER) {
+		FileScan fscan(relationName, bufMgrIn);
+		try
+		{
+			RecordId scanRid;
+			while (1)
+			{
+				fscan.scanNext(scanRid);
+				std::string recordStr = fscan.getRecord();
+				const char *record = recordStr.c_str();
+				entries.push_back(std::make_pair(*((int*)(record + attrByteOffset)), scanRid));
+			}
+		}
+		catch(EndOfFileException e)
+		{
+			std::cout << "Read relation and creating sharded index" << std::endl;
+		}
+	} else {
+		std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
+		shardCount = 1;
+	}
+
+	std::vector<int> keys(entries.size());
+	for (size_t i = 0; i < entries.size(); i++)
+		keys[i] = entries[i].first;
+	std::sort(keys.begin(), keys.end());
+
+	shards.push_back(openShard(nextShardId++, false, 0, true));
+	for (int s = 1; s < shardCount && !keys.empty(); s++) {
+		int low = keys[keys.size() * s / shardCount];
+		if (low <= keys[0] || (shards.back()->hasLow && low <= shards.back()->low))
+			continue;
+		shards.push_back(openShard(nextShardId++, true, low, true));
+	}
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		IndexShard* shard = shards[findShard(entries[i].first)];
+		shard->index->insertEntry(&entries[i].first, entries[i].second);
+		shard->entryCount++;
+	}
+}
+
+IndexShard* ShardedBTreeIndex::startSplit(size_t position)
+{
+	IndexShard* shard = shards[position];
+	std::lock_guard<std::mutex> shardLatch(shard->latch);
+	if (shard->splitting || shard->entryCount <= shard->splitThreshold)
+		return NULL;
+	// from here on inserts into the shard are held back, so its index is
+	// left to the split
+	shard->splitting = true;
+	splitsInProgress++;
+	return shard;
+}
+
+/*
+ * The shard's entries are read with a full scan, which hands them out in
+ * key order, and inserted into two new shards split at the median key.
+ * The new shards are written to their files before the directory names
+ * them. The old shard's file is removed once the directory no longer
+ * names it.
+*/
+const void ShardedBTreeIndex::splitShard(IndexShard* shard)
+{
+	std::vector<int> keys;
+	std::vector<RecordId> rids;
+	int lowest = INT_MIN;
+	int highest = INT_MAX;
+	try {
+		shard->index->startScan(&lowest, GTE, &highest, LTE);
+		try {
+			LeafEntrySpan<int> span;
+			while (1) {
+				shard->index->scanNextSpan(span);
+				keys.insert(keys.end(), span.keys, span.keys + span.count);
+				rids.insert(rids.end(), span.rids, span.rids + span.count);
+			}
+		} catch (IndexScanCompletedException e) {
+		}
+		shard->index->endScan();
+	} catch (NoSuchKeyFoundException e) {
+	}
+
+	// the first key from the median on that differs from the one before
+	// it, else the last one before the median, so that every copy of a key
+	// stays in one half and both halves get entries
+	size_t splitAt = keys.size() / 2;
+	while (splitAt > 0 && splitAt < keys.size() && keys[splitAt] == keys[splitAt - 1])
+		splitAt++;
+	if (splitAt == keys.size()) {
+		splitAt = keys.size() / 2;
+		while (splitAt > 0 && keys[splitAt] == keys[splitAt - 1])
+			splitAt--;
+	}
+	if (splitAt == 0) {
+		std::cout << "Shard " << shard->id << " holds a single key and is not split" << std::endl;
+		std::lock_guard<std::mutex> directory(directoryLatch);
+		{
+			std::lock_guard<std::mutex> shardLatch(shard->latch);
+			shard->splitThreshold = 2 * std::max(shard->splitThreshold, shard->entryCount);
+			shard->splitting = false;
+			for (size_t i = 0; i < shard->heldEntries.size(); i++)
+				shard->index->insertEntry(&shard->heldEntries[i].first, shard->heldEntries[i].second);
+			shard->heldEntries.clear();
+		}
+		if (--splitsInProgress == 0)
+			splitsDone.notify_all();
+		return;
+	}
+
+	int leftId;
+	int rightId;
+	{
+		std::lock_guard<std::mutex> directory(directoryLatch);
+		leftId = nextShardId++;
+		rightId = nextShardId++;
+	}
+	IndexShard* left = openShard(leftId, shard->hasLow, shard->low, true);
+	IndexShard* right = openShard(rightId, true, keys[splitAt], true);
+	for (size_t i = 0; i < keys.size(); i++) {
+		IndexShard* half = (i < splitAt) ? left : right;
+		half->index->insertEntry(&keys[i], rids[i]);
+		half->entryCount++;
+	}
+
+	// entries inserted into the old shard while it was read; the last
+	// ones are taken below, once no insert can reach it any more
+	std::vector< std::pair<int, RecordId> > held;
+	{
+		std::lock_guard<std::mutex> shardLatch(shard->latch);
+		held.swap(shard->heldEntries);
+	}
+	for (size_t i = 0; i < held.size(); i++) {
+		IndexShard* half = (held[i].first < right->low) ? left : right;
+		half->index->insertEntry(&held[i].first, held[i].second);
+		half->entryCount++;
+	}
+	left->index->flush();
+	right->index->flush();
+
+	bool saved;
+	{
+		std::lock_guard<std::mutex> directory(directoryLatch);
+		{
+			std::lock_guard<std::mutex> shardLatch(shard->latch);
+			held.clear();
+			held.swap(shard->heldEntries);
+		}
+		if (!held.empty()) {
+			for (size_t i = 0; i < held.size(); i++) {
+				IndexShard* half = (held[i].first < right->low) ? left : right;
+				half->index->insertEntry(&held[i].first, held[i].second);
+				half->entryCount++;
+			}
+			left->index->flush();
+			right->index->flush();
+		}
+
+		size_t position = std::find(shards.begin(), shards.end(), shard) - shards.begin();
+		shards[position] = left;
+		shards.insert(shards.begin() + position + 1, right);
+		saved = saveDirectory();
+		if (--splitsInProgress == 0)
+			splitsDone.notify_all();
+	}
+
+	int oldId = shard->id;
+	closeShard(shard);
+	std::lock_guard<std::mutex> directory(directoryLatch);
+	retiredShardIds.push_back(oldId);
+	// else the directory file still names the old shard, which stays until
+	// the directory is written next
+	if (saved)
+		removeRetiredShards();
+}
+
+size_t ShardedBTreeIndex::shardCount()
+{
+	std::lock_guard<std::mutex> directory(directoryLatch);
+	return shards.size();
+}
+
+// -----------------------------------------------------------------------------
+// ShardedBTreeIndex::insertEntry
+// -----------------------------------------------------------------------------
+
+const void ShardedBTreeIndex::insertEntry(const void *key, const RecordId rid)
+{
+	if (shardOptions.openMode == READ_ONLY_MAPPED)
+		throw IndexReadOnlyException();
+	if (attributeType != INTEGER){
+		std::cout << "NON INTEGER TYPE INDEX NOT SUPPORTED.";
+		return;
+	}
+
+	// find the shard and latch it before letting go of the directory, so
+	// that it cannot be split away in between
+	IndexShard* shard;
+	{
+		std::lock_guard<std::mutex> directory(directoryLatch);
+		shard = shards[findShard(*((int*)key))];
+		shard->latch.lock();
+	}
+
+	bool oversized;
+	{
+		std::lock_guard<std::mutex> shardLatch(shard->latch, std::adopt_lock);
+		if (splitEntries > 0 && !shard->entryCountKnown)
+			countShardEntries(shard);
+		// a scan or a split is using the shard's index
+		if (shard->scanOpen || shard->splitting)
+			shard->heldEntries.push_back(std::make_pair(*((int*)key), rid));
+		else
+			shard->index->insertEntry(key, rid);
+		shard->entryCount++;
+		oversized = (splitEntries > 0 && shard->entryCount > shard->splitThreshold);
+	}
+	if (!oversized)
+		return;
+
+	// the shard may have been split away meanwhile, so it is looked up again
+	IndexShard* splitting = NULL;
+	{
+		std::lock_guard<std::mutex> directory(directoryLatch);
+		// the scan walks the current list of shards
+		if (scanExecuting)
+			splitPending = true;
+		else
+			splitting = startSplit(findShard(*((int*)key)));
+	}
+	if (splitting != NULL)
+		splitShard(splitting);
+}
+
+// -----------------------------------------------------------------------------
+// ShardedBTreeIndex::startScan
+// -----------------------------------------------------------------------------
+
+const void ShardedBTreeIndex::startScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm)
+{
+	if (scanExecuting)
+		endScan();
+	if (lowOpParm != GT && lowOpParm != GTE)
+		throw BadOpcodesException();
+	if (highOpParm != LT && highOpParm != LTE)
+		throw BadOpcodesException();
+	lowValInt = *(int*)lowValParm;
+	highValInt = *(int*)highValParm;
+	if (lowValInt > highValInt)
+		throw BadScanrangeException();
+	lowOp = lowOpParm;
+	highOp = highOpParm;
+
+	{
+		std::unique_lock<std::mutex> directory(directoryLatch);
+		// a split would change the list of shards under the scan
+		while (splitsInProgress > 0)
+			splitsDone.wait(directory);
+		scanExecuting = true;
+		scanLastPosition = findShard(highValInt);
+		scanPosition = findShard(lowValInt);
+	}
+	if (!startShardScan(scanPosition)) {
+		endScan();
+		throw NoSuchKeyFoundException();
+	}
+}
+
+bool ShardedBTreeIndex::startShardScan(size_t position)
+{
+	shardScanExecuting = false;
+	for (scanPosition = position; scanPosition <= scanLastPosition; scanPosition++) {
+		IndexShard* shard = shards[scanPosition];
+		std::lock_guard<std::mutex> shardLatch(shard->latch);
+		try {
+			shard->index->startScan(&lowValInt, lowOp, &highValInt, highOp);
+			shard->scanOpen = true;
+			shardScanExecuting = true;
+			return true;
+		} catch (NoSuchKeyFoundException e) {
+		}
+	}
+	return false;
+}
+
+// -----------------------------------------------------------------------------
+// ShardedBTreeIndex::scanNext
+// -----------------------------------------------------------------------------
+
+const void ShardedBTreeIndex::scanNext(RecordId& outRid)
+{
+	if (!scanExecuting)
+		throw ScanNotInitializedException();
+
+	while (shardScanExecuting) {
+		IndexShard* shard = shards[scanPosition];
+		{
+			std::lock_guard<std::mutex> shardLatch(shard->latch);
+			try {
+				shard->index->scanNext(outRid);
+				return;
+			} catch (IndexScanCompletedException e) {
+				endShardScan(shard);
+			}
+		}
+		startShardScan(scanPosition + 1);
+	}
+	throw IndexScanCompletedException();
+}
+
+// -----------------------------------------------------------------------------
+// ShardedBTreeIndex::endScan
+// -----------------------------------------------------------------------------
+
+const void ShardedBTreeIndex::endScan()
+{
+	if (!scanExecuting)
+		throw ScanNotInitializedException();
+
+	if (shardScanExecuting) {
+		IndexShard* shard = shards[scanPosition];
+		std::lock_guard<std::mutex> shardLatch(shard->latch);
+		endShardScan(shard);
+		shardScanExecuting = false;
+	}
+
+	std::vector<IndexShard*> splitting;
+	{
+		std::lock_guard<std::mutex> directory(directoryLatch);
+		scanExecuting = false;
+		if (splitPending) {
+			splitPending = false;
+			for (size_t i = 0; i < shards.size(); i++) {
+				IndexShard* shard = startSplit(i);
+				if (shard != NULL)
+					splitting.push_back(shard);
+			}
+		}
+	}
+	for (size_t i = 0; i < splitting.size(); i++)
+		splitShard(splitting[i]);
+}
+
+const void ShardedBTreeIndex::endShardScan(IndexShard* shard)
+{
+	shard->index->endScan();
+	shard->scanOpen = false;
+	for (size_t i = 0; i < shard->heldEntries.size(); i++)
+		shard->index->insertEntry(&shard->heldEntries[i].first, shard->heldEntries[i].second);
+	shard->heldEntries.clear();
+}
+
+}
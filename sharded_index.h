@@ -0,0 +1,348 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "btree.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief One shard of a ShardedBTreeIndex: a BTreeIndex over the keys from low up to the low of the next
+ * shard, with its own index file and its own buffer manager, so that it shares no state with the others.
+*/
+struct IndexShard{
+  /**
+   * Number of the shard, its index file is "<relation name>.<attribute byte offset>.shard<id>".
+   */
+	int id;
+
+  /**
+   * False for the first shard, which takes every key below the low of the second.
+   */
+	bool hasLow;
+
+  /**
+   * Smallest key of the shard.
+   */
+	int low;
+
+  /**
+   * Buffer manager of the shard's index file. NULL for a mapped index.
+   */
+	BufMgr* bufMgr;
+
+  /**
+   * Index over the shard's keys.
+   */
+	BTreeIndex* index;
+
+  /**
+   * Number of entries in the shard, the held back ones included. Only kept once entryCountKnown.
+   */
+	std::uint64_t entryCount;
+
+  /**
+   * False until entryCount was measured. A shard that was opened is measured on its first insert,
+   * and only if shards are split.
+   */
+	bool entryCountKnown;
+
+  /**
+   * Number of entries above which the shard is split.
+   */
+	std::uint64_t splitThreshold;
+
+  /**
+   * True while a scan of the ShardedBTreeIndex has a scan open on the shard's index.
+   */
+	bool scanOpen;
+
+  /**
+   * True while the shard is being split. The splitting thread is then the only one using the index.
+   */
+	bool splitting;
+
+  /**
+   * Entries inserted while the shard's index could not take them (scanOpen or splitting), in insert order.
+   */
+	std::vector< std::pair<int, RecordId> > heldEntries;
+
+  /**
+   * Held while the shard's index, buffer manager or the fields above are in use.
+   */
+	std::mutex latch;
+};
+
+/**
+ * @brief Index over an INTEGER attribute range-partitioned across independent BTreeIndex instances.
+ * Each shard has its own file, root and buffer manager and is latched on its own, so inserts going to
+ * different shards run in parallel; only the lookup of the shard for a key is serialized. A shard that
+ * grows past a number of entries is split in two at its median key. The shard boundaries are kept in
+ * "<relation name>.<attribute byte offset>.shards".
+ * Scans run over the shards in key order; since shards hold disjoint key ranges this yields the entries
+ * in key order. Scans are driven by one thread at a time, and while one runs shard splits are deferred.
+ * Entries inserted into the shard a scan is on are held back until the scan leaves the shard.
+ * A split builds the two new shards without the directory latch, inserts into the old shard meanwhile
+ * are held back and go to the new shards when they replace it.
+*/
+class ShardedBTreeIndex {
+
+ private:
+
+  /**
+   * Name of the relation the index is built over.
+   */
+	std::string		relationName;
+
+  /**
+   * Offset of attribute, over which index is built, inside records.
+   */
+	int			attrByteOffset;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Name of the shard directory file.
+   */
+	std::string		directoryFileName;
+
+  /**
+   * Options every shard index is opened with.
+   */
+	IndexOptions	shardOptions;
+
+  /**
+   * Number of frames of the buffer manager of each shard.
+   */
+	std::uint32_t	shardBufferFrames;
+
+  /**
+   * Number of entries above which a shard is split, 0 to never split.
+   */
+	std::uint64_t	splitEntries;
+
+  /**
+   * Number for the next shard created.
+   */
+	int			nextShardId;
+
+  /**
+   * The shards, in key order.
+   */
+	std::vector<IndexShard*>	shards;
+
+  /**
+   * Held while the shard list is read or changed. A shard's latch is taken while holding this one,
+   * never the other way round.
+   */
+	std::mutex	directoryLatch;
+
+  /**
+   * Held while a shard's index file is created, opened, closed or removed, since the file bookkeeping
+   * is shared by every shard. May be taken while holding the directory latch, never the other way round.
+   */
+	std::mutex	fileLatch;
+
+  /**
+   * Number of shard splits between being started and replacing the shard, during which no scan may start.
+   */
+	int			splitsInProgress;
+
+  /**
+   * Notified with the directory latch held when splitsInProgress drops to 0.
+   */
+	std::condition_variable	splitsDone;
+
+  /**
+   * Numbers of shards split away whose files are removed once the directory is written without them.
+   */
+	std::vector<int>	retiredShardIds;
+
+  /**
+   * True if a scan was started.
+   */
+	bool		scanExecuting;
+
+  /**
+   * True if a shard grew past its split threshold during the scan.
+   */
+	bool		splitPending;
+
+  /**
+   * Position in shards of the shard being scanned.
+   */
+	size_t	scanPosition;
+
+  /**
+   * Position in shards of the last shard the scan may reach.
+   */
+	size_t	scanLastPosition;
+
+  /**
+   * True if the shard at scanPosition has a scan started on it.
+   */
+	bool		shardScanExecuting;
+
+  /**
+   * Scan bounds, handed to the scans of the shards.
+   */
+	int			lowValInt;
+	int			highValInt;
+	Operator	lowOp;
+	Operator	highOp;
+
+  /**
+   * Name of the index file of a shard.
+   */
+	std::string shardIndexName(int id) const;
+
+  /**
+   * Open the index of a shard, or create it, replacing a file left over under its name.
+   */
+	IndexShard* openShard(int id, bool hasLow, int low, bool create);
+
+  /**
+   * Close the index of a shard and free it.
+   */
+	const void closeShard(IndexShard* shard);
+
+  /**
+   * Measure entryCount of a shard that was opened. Call with the shard's latch held.
+   */
+	const void countShardEntries(IndexShard* shard);
+
+  /**
+   * Position in shards of the shard holding a key.
+   */
+	size_t findShard(int key) const;
+
+  /**
+   * Write the shard boundaries to the directory file.
+   * @return	False, leaving the directory file as it was, if it could not be written.
+   */
+	bool saveDirectory();
+
+  /**
+   * Remove the files of retiredShardIds. Call once the directory file was written without them.
+   */
+	const void removeRetiredShards();
+
+  /**
+   * Read the shard boundaries from the directory file and open the shards.
+   */
+	const void loadDirectory();
+
+  /**
+   * Read the keys of the relation and create shardCount shards at their quantiles, filled with the entries.
+   */
+	const void createShards(BufMgr* bufMgrIn, int shardCount);
+
+  /**
+   * Mark the shard at a position as splitting if it is past its threshold and not splitting yet.
+   * The directory latch has to be held.
+   * @return	The shard, to be passed to splitShard(), or NULL
+   */
+	IndexShard* startSplit(size_t position);
+
+  /**
+   * Replace a shard marked by startSplit() by two shards holding the keys below and from its median key.
+   * The directory latch must not be held.
+   */
+	const void splitShard(IndexShard* shard);
+
+  /**
+   * End the scan open on a shard and insert the entries held back during it. The shard latch has to be held.
+   */
+	const void endShardScan(IndexShard* shard);
+
+  /**
+   * Start the scan on the first shard from position on that has entries in range.
+   * @return	False if there is none up to scanLastPosition
+   */
+	bool startShardScan(size_t position);
+
+ public:
+
+  /**
+   * Open the sharded index over the attribute, or create it with shardCount shards and insert an entry
+   * for every record of the relation.
+   *
+   * @param relationName				Name of file.
+   * @param outIndexName				Return the name the shard index files start with.
+   * @param bufMgrIn						Buffer Manager Instance used to read the relation
+   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
+   * @param attrType						Datatype of attribute over which index is built
+   * @param shardCount					Number of shards of a new index
+   * @param shardBufferFrames		Number of buffer frames of each shard
+   * @param splitEntries				Number of entries above which a shard is split, 0 to never split
+   * @param options							Options for the shard index files; each shard traces to its own file, see IndexOptions::traceFileName
+   * @throws  FileNotFoundException     If the index is to be mapped read-only but does not exist.
+   */
+	ShardedBTreeIndex(const std::string & relationName, std::string & outIndexName,
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const int shardCount, const std::uint32_t shardBufferFrames, const std::uint64_t splitEntries,
+						const IndexOptions& options = IndexOptions());
+
+  /**
+   * Close every shard and write the directory file.
+   */
+	~ShardedBTreeIndex();
+
+  /**
+	 * Insert a new entry into the shard holding its key. Safe to call from several threads at once.
+   * @param key			Key to insert, pointer to integer
+   * @param rid			Record ID of a record whose entry is getting inserted into the index.
+	 * @throws  IndexReadOnlyException If the shards are opened READ_ONLY_MAPPED.
+	**/
+	const void insertEntry(const void* key, const RecordId rid);
+
+  /**
+	 * Number of shards.
+	**/
+	size_t shardCount();
+
+  /**
+	 * Begin a filtered scan over the shards, see BTreeIndex::startScan().
+   * @param lowVal	Low value of range, pointer to integer
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in any shard which satisfies the scan criteria.
+	**/
+	const void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan, moving on to the next shard when
+	 * one is exhausted.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	const void scanNext(RecordId& outRid);
+
+  /**
+	 * Terminate the current scan and carry out the shard splits deferred during it.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	const void endScan();
+};
+
+}
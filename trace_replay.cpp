@@ -0,0 +1,323 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+/*
+ * Reruns a trace recorded through IndexOptions::traceFileName against a
+ * fresh index and reports throughput, latency histograms and the buffer
+ * manager's page access counts. The index is first filled, untimed, with
+ * the entries the traced index held when tracing started, and is created
+ * with the options given on the command line, which should match the
+ * ones of the traced index.
+ *
+ * Usage: trace_replay <trace file> [buffer frames] [options]
+ *   --compress-leaves       IndexOptions::compressLeaves
+ *   --search-block          IndexOptions::nonLeafSearchBlock
+ *   --insert-buffer=N       IndexOptions::insertBufferSize
+ *   --bloom-keys=N          IndexOptions::bloomExpectedKeys
+ *   --bloom-fp=RATE         IndexOptions::bloomFalsePositiveRate, between 0 and 1
+*/
+
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "btree.h"
+#include "index_trace.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+#include "exceptions/bad_opcodes_exception.h"
+#include "exceptions/bad_scanrange_exception.h"
+#include "exceptions/bad_index_info_exception.h"
+
+using namespace badgerdb;
+
+/*
+ * Number of log2 buckets of a latency histogram: bucket b counts calls
+ * that took from 2^b up to 2^(b+1) - 1 ns.
+*/
+static const int LATENCY_BUCKETS = 40;
+
+static const int TRACE_OP_COUNT = 8;
+
+/*
+ * Names of the calls by TraceOp; the records that are not calls have none.
+*/
+static const char* TRACE_OP_NAMES[TRACE_OP_COUNT] = { "insertEntry", "startScan", "scanNext", "endScan", NULL,
+	"scanNextSpan", "lookupBatch", NULL };
+
+/*
+ * Calls, total time and latency histogram of one kind of operation.
+*/
+struct OpStats{
+	std::uint64_t calls;
+	std::uint64_t threw;
+	std::uint64_t totalNs;
+	std::uint64_t recordedNs;
+	std::uint64_t histogram[LATENCY_BUCKETS];
+};
+
+static int latencyBucket(std::uint64_t ns)
+{
+	int bucket = 0;
+	while (ns > 1 && bucket < LATENCY_BUCKETS - 1) {
+		ns >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+/*
+ * Run one traced call, a lookupBatch with the keys of the TRACE_BATCH_KEY
+ * records before it. Exceptions the recorded call may have ended with as
+ * well are part of the workload.
+*/
+static bool replay(BTreeIndex& index, const TraceRecord& record, const std::vector<int>& batchKeys)
+{
+	try {
+		switch (record.op) {
+		case TRACE_INSERT: {
+			int key = record.key;
+			RecordId rid;
+			rid.page_number = record.pageNumber;
+			rid.slot_number = record.slotNumber;
+			index.insertEntry(&key, rid);
+			break;
+		}
+		case TRACE_START_SCAN: {
+			int low = record.key;
+			int high = record.high;
+			index.startScan(&low, (Operator)record.lowOp, &high, (Operator)record.highOp);
+			break;
+		}
+		case TRACE_SCAN_NEXT: {
+			RecordId rid;
+			index.scanNext(rid);
+			break;
+		}
+		case TRACE_END_SCAN:
+			index.endScan();
+			break;
+		case TRACE_SCAN_NEXT_SPAN: {
+			LeafEntrySpan<int> span;
+			index.scanNextSpan(span);
+			break;
+		}
+		case TRACE_LOOKUP_BATCH: {
+			std::vector<RecordId> rids;
+			std::vector<size_t> offsets;
+			index.lookupBatch(batchKeys.empty() ? NULL : &batchKeys[0], batchKeys.size(), rids, offsets);
+			break;
+		}
+		}
+	} catch (NoSuchKeyFoundException e) {
+		return true;
+	} catch (IndexScanCompletedException e) {
+		return true;
+	} catch (ScanNotInitializedException e) {
+		return true;
+	} catch (BadOpcodesException e) {
+		return true;
+	} catch (BadScanrangeException e) {
+		return true;
+	}
+	return false;
+}
+
+/*
+ * A whole argument as a number from 0 to max, digits only.
+ * @return	False if it is not one
+*/
+static bool parseNumber(const char* text, std::uint64_t max, std::uint64_t& outValue)
+{
+	if (*text < '0' || *text > '9')
+		return false;
+	char* end;
+	errno = 0;
+	unsigned long long value = strtoull(text, &end, 10);
+	if (errno != 0 || *end != '\0' || value > max)
+		return false;
+	outValue = value;
+	return true;
+}
+
+/*
+ * A whole argument as a rate between 0 and 1, both excluded.
+ * @return	False if it is not one
+*/
+static bool parseRate(const char* text, double& outValue)
+{
+	char* end;
+	errno = 0;
+	double value = strtod(text, &end);
+	if (end == text || errno != 0 || *end != '\0' || !(value > 0 && value < 1))
+		return false;
+	outValue = value;
+	return true;
+}
+
+/*
+ * Set the index option an argument names.
+ * @return	False if it names none or its value is not valid
+*/
+static bool parseOption(const char* arg, IndexOptions& options)
+{
+	std::uint64_t value;
+	if (strcmp(arg, "--compress-leaves") == 0)
+		options.compressLeaves = true;
+	else if (strcmp(arg, "--search-block") == 0)
+		options.nonLeafSearchBlock = true;
+	else if (strncmp(arg, "--insert-buffer=", 16) == 0 && parseNumber(arg + 16, INT_MAX, value))
+		options.insertBufferSize = (int)value;
+	else if (strncmp(arg, "--bloom-keys=", 13) == 0 && parseNumber(arg + 13, UINT64_MAX, value))
+		options.bloomExpectedKeys = value;
+	else if (strncmp(arg, "--bloom-fp=", 11) == 0)
+		return parseRate(arg + 11, options.bloomFalsePositiveRate);
+	else
+		return false;
+	return true;
+}
+
+static void printUsage(const char* program)
+{
+	std::cout << "Usage: " << program << " <trace file> [buffer frames] [--compress-leaves] [--search-block]"
+		<< " [--insert-buffer=N] [--bloom-keys=N] [--bloom-fp=RATE]" << std::endl;
+}
+
+static void printStats(const char* name, const OpStats& stats)
+{
+	if (stats.calls == 0)
+		return;
+	std::cout << name << ": " << stats.calls << " calls, " << stats.threw << " threw, "
+		<< (double)stats.totalNs / stats.calls << " ns average (" << (double)stats.recordedNs / stats.calls
+		<< " ns when recorded)" << std::endl;
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		if (stats.histogram[b] != 0)
+			std::cout << "  >= " << (1ULL << b) << " ns: " << stats.histogram[b] << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	std::uint32_t frames = 100;
+	IndexOptions options;
+	for (int i = 2; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) != 0) {
+			std::uint64_t value;
+			if (!parseNumber(argv[i], UINT32_MAX, value) || value == 0) {
+				std::cout << "Bad number of buffer frames " << argv[i] << std::endl;
+				printUsage(argv[0]);
+				return 1;
+			}
+			frames = (std::uint32_t)value;
+		} else if (!parseOption(argv[i], options)) {
+			std::cout << "Unknown or bad option " << argv[i] << std::endl;
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	// the relation is never read, the trace holds the starting content
+	options.buildFromRelation = false;
+
+	std::ifstream in(argv[1], std::ios::binary);
+	TraceFileHeader header;
+	if (!in.read((char*)&header, sizeof(header)) || header.magic != TRACE_FILE_MAGIC
+			|| header.version != TRACE_FILE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+		std::cout << argv[1] << " is not a trace file of this version" << std::endl;
+		return 1;
+	}
+
+	const std::string relationName = "trace_replay";
+	const std::string indexName = relationName + ".0";
+	if (File::exists(indexName))
+		File::remove(indexName);
+	BufMgr* bufMgr = new BufMgr(frames);
+	OpStats stats[TRACE_OP_COUNT] = {};
+	std::uint64_t totalCalls = 0;
+	std::uint64_t totalNs = 0;
+	std::uint64_t loadedEntries = 0;
+	try {
+		std::string outIndexName;
+		BTreeIndex index(relationName, outIndexName, bufMgr, 0, INTEGER, options);
+
+		// the content of the index when tracing started, written first
+		TraceRecord record;
+		bool haveRecord = false;
+		while (in.read((char*)&record, sizeof(record))) {
+			if (record.op != TRACE_LOAD) {
+				haveRecord = true;
+				break;
+			}
+			int key = record.key;
+			RecordId rid;
+			rid.page_number = record.pageNumber;
+			rid.slot_number = record.slotNumber;
+			index.insertEntry(&key, rid);
+			loadedEntries++;
+		}
+		index.flushInsertBuffer();
+		bufMgr->clearBufStats();
+
+		std::vector<int> batchKeys;
+		for (; haveRecord; haveRecord = (bool)in.read((char*)&record, sizeof(record))) {
+			if (record.op == TRACE_BATCH_KEY) {
+				batchKeys.push_back(record.key);
+				continue;
+			}
+			if (record.op >= TRACE_OP_COUNT || TRACE_OP_NAMES[record.op] == NULL)
+				continue;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			bool threw = replay(index, record, batchKeys);
+			if (record.op == TRACE_LOOKUP_BATCH)
+				batchKeys.clear();
+			std::uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+			OpStats& op = stats[record.op];
+			op.calls++;
+			op.threw += threw ? 1 : 0;
+			op.totalNs += ns;
+			op.recordedNs += record.durationNs;
+			op.histogram[latencyBucket(ns)]++;
+			totalCalls++;
+			totalNs += ns;
+		}
+
+		BufStats& bufStats = bufMgr->getBufStats();
+		std::cout << "Loaded " << loadedEntries << " entries" << std::endl;
+		std::cout << "Replayed " << totalCalls << " calls in " << (double)totalNs / 1e9 << " s, "
+			<< (totalNs > 0 ? (double)totalCalls * 1e9 / totalNs : 0) << " calls/s" << std::endl;
+		std::cout << "Buffer manager: " << bufStats.accesses << " page accesses, " << bufStats.diskreads
+			<< " disk reads, " << bufStats.diskwrites << " disk writes" << std::endl;
+		for (int op = 0; op < TRACE_OP_COUNT; op++) {
+			if (TRACE_OP_NAMES[op] != NULL)
+				printStats(TRACE_OP_NAMES[op], stats[op]);
+		}
+	} catch (BadIndexInfoException e) {
+		std::cout << "Cannot create the index: " << e.message() << std::endl;
+		printUsage(argv[0]);
+		delete bufMgr;
+		if (File::exists(indexName))
+			File::remove(indexName);
+		return 1;
+	}
+
+	delete bufMgr;
+	File::remove(indexName);
+	std::remove((indexName + ".bloom").c_str());
+	return 0;
+}